@@ -1,5 +1,5 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
  *           Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
@@ -16,7 +16,7 @@
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__ and __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
@@ -71,6 +71,40 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+#elif defined(__x86_64__)
+/*******************************************************
+ * x86-64 versions of start_counter() and get_counter()
+ *******************************************************/
+
+/* Initialize the cycle counter */
+static unsigned long long cyc_start = 0;
+
+/* Return the time stamp counter. rdtscp waits for every earlier
+   instruction to finish, and the lfence keeps later ones from
+   starting before the counter has been read. */
+static unsigned long long access_counter(void)
+{
+    unsigned hi, lo, aux;
+
+    asm volatile("rdtscp; lfence"
+		 : "=d" (hi), "=a" (lo), "=c" (aux)
+		 : /* No input */
+		 : "memory");
+    return ((unsigned long long) hi << 32) | lo;
+}
+
+/* Record the current value of the cycle counter. */
+void start_counter()
+{
+    cyc_start = access_counter();
+}
+
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
+{
+    return (double) (access_counter() - cyc_start);
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <math.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -17,6 +18,7 @@
 /* Default values */
 #define K 3                  /* Value of K in K-best scheme */
 #define MAXSAMPLES 20        /* Give up after MAXSAMPLES */
+#define MINSAMPLES 0         /* Take at least MINSAMPLES */
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
@@ -25,6 +27,7 @@
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
+static int minsamples = MINSAMPLES;
 static double epsilon = EPSILON;
 static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
@@ -35,10 +38,13 @@ static int *cache_buf = NULL;
 
 static double *values = NULL;
 static int samplecount = 0;
+static double samplesum = 0;   /* sum of all the samples */
+static double samplesumsq = 0; /* sum of their squares */
 
 /* for debugging only */
 #define KEEP_VALS 0
 #define KEEP_SAMPLES 0
+#define PRINT_VALS 0
 
 #if KEEP_SAMPLES
 static double *samples = NULL;
@@ -59,6 +65,8 @@ static void init_sampler()
     samples = calloc(maxsamples+kbest, sizeof(double));
 #endif
     samplecount = 0;
+    samplesum = 0;
+    samplesumsq = 0;
 }
 
 /* 
@@ -78,6 +86,8 @@ static void add_sample(double val)
     samples[samplecount] = val;
 #endif
     samplecount++;
+    samplesum += val;
+    samplesumsq += val*val;
     /* Insertion sort */
     while (pos > 0 && values[pos-1] > values[pos]) {
 	double temp = values[pos-1];
@@ -93,7 +103,7 @@ static void add_sample(double val)
 static int has_converged()
 {
     return
-	(samplecount >= kbest) &&
+	(samplecount >= kbest) && (samplecount >= minsamples) &&
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
@@ -151,7 +161,7 @@ double fcyc(test_funct f, void *argp)
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     }
-#ifdef DEBUG
+#if PRINT_VALS
     {
 	int i;
 	printf(" %d smallest values: [", kbest);
@@ -167,6 +177,30 @@ double fcyc(test_funct f, void *argp)
     return result;  
 }
 
+/*
+ * fcyc_spread - Return the number of samples the last call to fcyc
+ *     took, with their mean and standard deviation in *mean and *stddev
+ */
+int fcyc_spread(double *mean, double *stddev)
+{
+    double var = 0;
+
+    *mean = samplecount ? samplesum / samplecount : 0;
+    if (samplecount > 1)
+	var = (samplesumsq - samplesum * *mean) / (samplecount - 1);
+    *stddev = var > 0 ? sqrt(var) : 0;
+    return samplecount;
+}
+
+/*
+ * clear_fcyc_cache - Evict the cache, as fcyc does before each sample
+ *     when set_fcyc_clear_cache is on
+ */
+void clear_fcyc_cache(void)
+{
+    clear();
+}
+
 
 /*************************************************************
  * Set the various parameters used by the measurement routines 
@@ -236,6 +270,17 @@ void set_fcyc_maxsamples(int maxsamples_arg)
     maxsamples = maxsamples_arg;
 }
 
+/* 
+ * set_fcyc_minsamples - Minimum number of samples to take, even when
+ *     K-best has converged before, so that fcyc_spread has enough
+ *     samples to go on.
+ *     Default = 0
+ */
+void set_fcyc_minsamples(int minsamples_arg)
+{
+    minsamples = minsamples_arg;
+}
+
 /* 
  * set_fcyc_epsilon - Tolerance required for K-best
  *     Default = 0.01
@@ -13,6 +13,12 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Number of samples the last fcyc took, and their mean and std deviation */
+int fcyc_spread(double *mean, double *stddev);
+
+/* Evict the cache, as done before each sample when clear_cache is set */
+void clear_fcyc_cache(void);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -57,6 +63,13 @@ void set_fcyc_k(int k);
  */
 void set_fcyc_maxsamples(int maxsamples_arg);
 
+/* 
+ * set_fcyc_minsamples - Minimum number of samples to take, even when
+ *     K-best has converged before
+ *     Default = 0
+ */
+void set_fcyc_minsamples(int minsamples_arg);
+
 /* 
  * set_fcyc_epsilon - Tolerance required for K-best
  *     Default = 0.01
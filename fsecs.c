@@ -1,17 +1,75 @@
 /****************************
  * High-level timing wrappers
  ****************************/
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <math.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+#define RUNS 10              /* samples of a gettod or itimer measurement */
+#define FCYC_RUNS 30         /* fewest samples of an fcyc measurement */
+#define COLD_BYTES (1<<25)   /* cache evicted by default in cold mode */
+
 static double Mhz;  /* estimated CPU clock frequency */
 
 extern int verbose; /* -v option in mdriver.c */
 
+/* The timing method, by default the one selected in config.h */
+static int method = USE_FCYC ? FSECS_FCYC : USE_ITIMER ? FSECS_ITIMER : FSECS_GETTOD;
+static int pin_cpu = -1;           /* CPU every measurement runs on, or -1 */
+static int cache_mode = FSECS_PLAIN;
+static int cache_bytes = COLD_BYTES;
+
+static cpu_set_t pinned;   /* affinity while measuring ... */
+static cpu_set_t unpinned; /* ... and the caller's, restored afterwards */
+
+/* Samples taken by the last call to fsecs, in seconds */
+static int nsamples = 0;
+static double mean = 0, stddev = 0;
+
+/*
+ * set_fsecs_method - Select the timing method, and the CPU to pin
+ *     every measurement to
+ */
+void set_fsecs_method(int method_arg, int cpu)
+{
+    method = method_arg;
+    pin_cpu = cpu;
+}
+
+/*
+ * set_fsecs_cache - Select whether each timed run starts with a warm
+ *     cache or with a cold one, after evicting bytes of it, or with
+ *     whatever the last run left (the default)
+ */
+void set_fsecs_cache(int mode, int bytes)
+{
+    cache_mode = mode;
+    cache_bytes = bytes ? bytes : COLD_BYTES;
+}
+
+/*
+ * pin - Move the calling thread to pin_cpu while measuring, and back
+ *     to wherever it was allowed to run before afterwards
+ */
+static void pin(int on)
+{
+    if (on) {
+	sched_getaffinity(0, sizeof(cpu_set_t), &unpinned);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &pinned) < 0) {
+	    fprintf(stderr, "Error: cannot run on CPU %d\n", pin_cpu);
+	    exit(1);
+	}
+    } else
+	sched_setaffinity(0, sizeof(cpu_set_t), &unpinned);
+}
+
 /*
  * init_fsecs - initialize the timing package
  */
@@ -19,39 +77,96 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+    if (method == FSECS_FCYC && pin_cpu < 0)
+	pin_cpu = sched_getcpu();
+    if (pin_cpu >= 0) {
+	CPU_ZERO(&pinned);
+	CPU_SET(pin_cpu, &pinned);
+	pin(1);
+    }
+
+    if (method == FSECS_FCYC) {
+	if (verbose)
+	    printf("Measuring performance with a cycle counter on CPU %d.\n", pin_cpu);
+
+	/*
+	 * set key parameters for the fcyc package. Enough samples are
+	 * taken to estimate their spread, and with the thread pinned the
+	 * K-best scheme already discards the samples a timer interrupt
+	 * lands in, so there is nothing to compensate for.
+	 */
+	set_fcyc_maxsamples(50);
+	set_fcyc_minsamples(FCYC_RUNS);
+	set_fcyc_clear_cache(cache_mode != FSECS_WARM);
+	set_fcyc_compensate(0);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = mhz(verbose > 0);
+    }
+    else if (method == FSECS_ITIMER) {
+	if (verbose)
+	    printf("Measuring performance with the interval timer.\n");
+    }
+    else {
+	if (verbose)
+	    printf("Measuring performance with gettimeofday().\n");
+    }
+    if (cache_mode == FSECS_COLD)
+	set_fcyc_cache_size(cache_bytes);
+    set_fcyc_cache_block(64);
+    if (verbose && cache_mode == FSECS_COLD)
+	printf("Evicting %d KB of cache before each run.\n", cache_bytes >> 10);
+
+    if (pin_cpu >= 0)
+	pin(0);
 }
 
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
-double fsecs(fsecs_test_funct f, void *argp) 
+double fsecs(fsecs_test_funct f, void *argp)
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
-}
+    double secs, sum = 0, sumsq = 0;
+    int i;
 
+    if (pin_cpu >= 0)
+	pin(1);
+    if (cache_mode == FSECS_WARM)
+	f(argp);
 
+    if (method == FSECS_FCYC) {
+	secs = fcyc(f, argp)/(Mhz*1e6);
+	nsamples = fcyc_spread(&mean, &stddev);
+	mean /= Mhz*1e6;
+	stddev /= Mhz*1e6;
+    }
+    else {
+	for (i = 0; i < RUNS; i++) {
+	    if (cache_mode == FSECS_COLD)
+		clear_fcyc_cache();
+	    secs = (method == FSECS_ITIMER) ?
+		ftimer_itimer(f, argp, 1) : ftimer_gettod(f, argp, 1);
+	    sum += secs;
+	    sumsq += secs*secs;
+	}
+	nsamples = RUNS;
+	mean = sum / RUNS;
+	stddev = sumsq - sum*mean > 0 ? sqrt((sumsq - sum*mean) / (RUNS - 1)) : 0;
+	secs = mean;
+    }
+
+    if (pin_cpu >= 0)
+	pin(0);
+    return secs;
+}
+
+/*
+ * fsecs_spread - Return the number of samples the last call to fsecs
+ *     took, with their mean and standard deviation in seconds
+ */
+int fsecs_spread(double *mean_arg, double *stddev_arg)
+{
+    *mean_arg = mean;
+    *stddev_arg = stddev;
+    return nsamples;
+}
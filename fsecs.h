@@ -1,4 +1,24 @@
 typedef void (*fsecs_test_funct)(void *);
 
+/* Timing methods for set_fsecs_method */
+#define FSECS_GETTOD 0  /* gettimeofday (any Unix box) */
+#define FSECS_ITIMER 1  /* interval timer (any Unix box) */
+#define FSECS_FCYC   2  /* cycle counter w/K-best scheme (x86, x86-64 & Alpha) */
+
+/* Cache state each timed run starts from, for set_fsecs_cache */
+#define FSECS_WARM   0  /* after an untimed run of the same function */
+#define FSECS_COLD   1  /* after evicting a cache of some size */
+#define FSECS_PLAIN  2  /* as it finds it, the default: no untimed run, and
+                           fcyc clears its own small cache as it always has */
+
+/* Both must be called before init_fsecs. cpu < 0 pins fcyc to the CPU
+   init_fsecs runs on, and leaves the other methods unpinned; bytes 0
+   evicts a default cache size. */
+void set_fsecs_method(int method, int cpu);
+void set_fsecs_cache(int mode, int bytes);
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Number of samples the last fsecs took, and their mean and std deviation */
+int fsecs_spread(double *mean, double *stddev);
@@ -0,0 +1,608 @@
+/*
+ * gentrace.c - Writes synthetic malloc lab traces
+ *
+ * A trace is generated one request per tick. Each block gets a size
+ * from a size distribution and a lifetime, in ticks, from a lifetime
+ * model when it is allocated; a fraction of the blocks also grow by
+ * realloc at random intervals while they live. Whenever a block's next
+ * event is due it is reallocated or freed, and otherwise a new block
+ * is allocated. The blocks still live when the trace reaches its
+ * length are freed at the end, so every trace is balanced.
+ *
+ * Size distributions (-s):
+ *    uniform:<min>:<max>           uniform in [min, max]
+ *    power:<alpha>:<min>:<max>     p(size) ~ size^-alpha in [min, max]
+ *    bimodal:<small>:<large>:<p>   within 25% of small with probability
+ *                                  p, and of large otherwise
+ *    hist:<file>                   "<size> <weight>" lines of a file
+ *
+ * Lifetime models (-l), in requests:
+ *    exp:<mean>                    exponential, so age tells nothing
+ *    pareto:<alpha>:<min>          heavy-tailed: most blocks die young
+ *                                  and a few live for the whole trace
+ *    phase:<len>                   all blocks of a phase of len requests
+ *                                  die together at its end
+ *
+ * Realloc growth (-r):
+ *    <frac>:linear:<bytes>[:<every>]  frac of the blocks grow by bytes,
+ *    <frac>:geom:<factor>[:<every>]   or by factor, every <every>
+ *                                     requests on average (default 16)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "trace.h"
+#include "config.h"
+
+/* Misc */
+#define MAXLINE      1024 /* max string size */
+#define GROW_EVERY     16 /* default mean requests between a block's reallocs */
+#define NEVER   (1LL << 62) /* tick of an event that does not happen */
+
+/* Kinds of size distributions and lifetime models */
+enum {SIZE_UNIFORM, SIZE_POWER, SIZE_BIMODAL, SIZE_HIST};
+enum {LIFE_EXP, LIFE_PARETO, LIFE_PHASE};
+enum {GROW_LINEAR, GROW_GEOM};
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* A size distribution */
+typedef struct {
+    int kind;            /* SIZE_xxx */
+    double a, b, c;      /* its parameters, in the order of the -s spec */
+    int num_bins;        /* histogram bins ... */
+    int *bin_sizes;      /* ... their sizes ... */
+    double *bin_cum;     /* ... and cumulative weights */
+} sizedist_t;
+
+/* A lifetime model */
+typedef struct {
+    int kind;            /* LIFE_xxx */
+    double a, b;         /* its parameters, in the order of the -l spec */
+} lifetime_t;
+
+/* Which blocks grow by realloc, and how */
+typedef struct {
+    double frac;         /* fraction of blocks that grow */
+    int kind;            /* GROW_xxx */
+    double amount;       /* bytes added, or factor multiplied by */
+    double every;        /* mean requests between reallocs */
+} growth_t;
+
+/* One live block, keyed in the event heap by the tick of its next event */
+typedef struct {
+    long long when;      /* min(next_grow, death) */
+    int id;
+} event_t;
+
+/* What is known about every block ever allocated */
+typedef struct {
+    int size;            /* current payload size */
+    long long death;     /* tick it is freed at */
+    long long next_grow; /* tick it is reallocated at next, or NEVER */
+} block_t;
+
+/********************
+ * Global variables
+ *******************/
+static unsigned long long rng_state = 1;  /* xorshift64* state (-S) */
+
+static traceop_t *ops = NULL;  /* the requests generated so far */
+static int num_ops = 0, max_ops = 0;
+static block_t *blocks = NULL; /* every block, by id */
+static int num_ids = 0, max_ids = 0;
+static event_t *heap = NULL;   /* the live blocks, earliest event on top */
+static int heap_size = 0;
+
+/*********************
+ * Function prototypes
+ *********************/
+static double rnd(void);
+static int parse_size(sizedist_t *d, char *spec);
+static int parse_life(lifetime_t *l, char *spec);
+static int parse_growth(growth_t *g, char *spec);
+static void read_hist(sizedist_t *d, char *path);
+static int draw_size(sizedist_t *d);
+static long long draw_death(lifetime_t *l, long long now);
+static long long draw_grow(growth_t *g, long long now);
+static void heap_push(long long when, int id);
+static event_t heap_pop(void);
+static void emit(int type, int id, int size);
+static void write_rep(char *path, size_t peak);
+static void write_bin(char *path, size_t peak);
+static void usage(void);
+static void unix_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    char c;
+    long target = 100000;       /* requests to generate (-n) */
+    size_t max_live = MAX_HEAP / 2; /* bound on live payload bytes (-m) */
+    int binary = 0;             /* write the binary format (-B) */
+    int verbose = 0;
+    sizedist_t sizes;
+    lifetime_t life;
+    growth_t growth;
+    size_t live = 0, peak = 0;
+    long long now = 0;
+    long reallocs = 0;
+    event_t ev;
+    block_t *b;
+    int id, size;
+
+    parse_size(&sizes, "power:1.5:8:4096");
+    parse_life(&life, "exp:1000");
+    parse_growth(&growth, "0:linear:0");
+
+    while ((c = getopt(argc, argv, "n:s:l:r:m:S:Bvh")) != EOF) {
+	switch (c) {
+	case 'n': /* Number of requests */
+	    target = atol(optarg);
+	    break;
+	case 's': /* Size distribution */
+	    if (parse_size(&sizes, optarg) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'l': /* Lifetime model */
+	    if (parse_life(&life, optarg) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'r': /* Realloc growth pattern */
+	    if (parse_growth(&growth, optarg) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'm': /* Bound on live payload bytes */
+	    max_live = strtoull(optarg, NULL, 0);
+	    break;
+	case 'S': /* Random seed */
+	    rng_state = strtoull(optarg, NULL, 0) | 1;
+	    break;
+	case 'B': /* Write a binary trace */
+	    binary = 1;
+	    break;
+	case 'v': /* Print a summary of the trace */
+	    verbose = 1;
+	    break;
+	case 'h': /* Print this message */
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if ((optind != argc - 1) || (target < 2) || (target >= (1L << 31)) ||
+	(max_live == 0)) {
+	usage();
+	exit(1);
+    }
+
+    /*
+     * Every alloc commits the trace to one more request, its free, so
+     * stop once the requests made and the frees owed reach the target
+     */
+    while (num_ops + heap_size + 1 < target) {
+	if ((heap_size > 0) && (heap[0].when <= now)) {
+	    ev = heap_pop();
+	    b = &blocks[ev.id];
+	    if (b->next_grow < b->death) {
+		size = (growth.kind == GROW_LINEAR) ?
+		    b->size + (int)growth.amount : (int)(b->size * growth.amount);
+		if ((size > b->size) && (size < (1 << 30)) &&
+		    (live + size - b->size <= max_live)) {
+		    emit(REALLOC, ev.id, size);
+		    live += size - b->size;
+		    b->size = size;
+		    reallocs++;
+		    b->next_grow = draw_grow(&growth, now);
+		}
+		else
+		    b->next_grow = NEVER; /* it has grown as far as it can */
+		heap_push((b->next_grow < b->death) ? b->next_grow : b->death, ev.id);
+		if (b->next_grow == NEVER)
+		    continue; /* no request was made */
+	    }
+	    else {
+		emit(FREE, ev.id, 0);
+		live -= b->size;
+	    }
+	}
+	else {
+	    size = draw_size(&sizes);
+	    if ((size_t)size > max_live)
+		size = max_live;
+	    if ((live + size > max_live) && (heap_size > 0)) {
+		/* Free the block that was going to go next to make room */
+		ev = heap_pop();
+		emit(FREE, ev.id, 0);
+		live -= blocks[ev.id].size;
+		now++;
+		continue;
+	    }
+	    if (num_ids == max_ids) {
+		max_ids = max_ids ? 2 * max_ids : 4096;
+		if ((blocks = realloc(blocks, max_ids * sizeof(block_t))) == NULL)
+		    unix_error("realloc failed in main");
+	    }
+	    id = num_ids++;
+	    blocks[id].size = size;
+	    blocks[id].death = draw_death(&life, now);
+	    blocks[id].next_grow = (rnd() < growth.frac) ? draw_grow(&growth, now) : NEVER;
+	    heap_push((blocks[id].next_grow < blocks[id].death) ?
+		      blocks[id].next_grow : blocks[id].death, id);
+	    emit(ALLOC, id, size);
+	    live += size;
+	    if (live > peak)
+		peak = live;
+	}
+	now++;
+    }
+
+    /* Free what is left, in the order it would have died */
+    while (heap_size > 0) {
+	ev = heap_pop();
+	emit(FREE, ev.id, 0);
+    }
+
+    if (binary)
+	write_bin(argv[optind], peak);
+    else
+	write_rep(argv[optind], peak);
+    if (verbose)
+	printf("%s: %d requests, %d blocks, %ld reallocs, peak %.1f KB live\n",
+	       argv[optind], num_ops, num_ids, reallocs, peak / 1024.0);
+    exit(0);
+}
+
+/*
+ * rnd - Returns a uniform random number in (0, 1)
+ */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ * parse_size - Reads a -s spec into d, returning -1 if it is malformed
+ */
+static int parse_size(sizedist_t *d, char *spec)
+{
+    memset(d, 0, sizeof(sizedist_t));
+    if (strncmp(spec, "uniform:", 8) == 0) {
+	d->kind = SIZE_UNIFORM;
+	if ((sscanf(spec + 8, "%lf:%lf", &d->a, &d->b) != 2) ||
+	    (d->a < 1) || (d->b < d->a))
+	    return -1;
+    }
+    else if (strncmp(spec, "power:", 6) == 0) {
+	d->kind = SIZE_POWER;
+	if ((sscanf(spec + 6, "%lf:%lf:%lf", &d->a, &d->b, &d->c) != 3) ||
+	    (d->a <= 0) || (d->b < 1) || (d->c < d->b))
+	    return -1;
+    }
+    else if (strncmp(spec, "bimodal:", 8) == 0) {
+	d->kind = SIZE_BIMODAL;
+	if ((sscanf(spec + 8, "%lf:%lf:%lf", &d->a, &d->b, &d->c) != 3) ||
+	    (d->a < 1) || (d->b < 1) || (d->c < 0) || (d->c > 1))
+	    return -1;
+    }
+    else if (strncmp(spec, "hist:", 5) == 0) {
+	d->kind = SIZE_HIST;
+	read_hist(d, spec + 5);
+    }
+    else
+	return -1;
+    return 0;
+}
+
+/*
+ * parse_life - Reads a -l spec into l, returning -1 if it is malformed
+ */
+static int parse_life(lifetime_t *l, char *spec)
+{
+    if (strncmp(spec, "exp:", 4) == 0) {
+	l->kind = LIFE_EXP;
+	return ((sscanf(spec + 4, "%lf", &l->a) == 1) && (l->a > 0)) ? 0 : -1;
+    }
+    if (strncmp(spec, "pareto:", 7) == 0) {
+	l->kind = LIFE_PARETO;
+	return ((sscanf(spec + 7, "%lf:%lf", &l->a, &l->b) == 2) &&
+		(l->a > 0) && (l->b >= 1)) ? 0 : -1;
+    }
+    if (strncmp(spec, "phase:", 6) == 0) {
+	l->kind = LIFE_PHASE;
+	return ((sscanf(spec + 6, "%lf", &l->a) == 1) && (l->a >= 1)) ? 0 : -1;
+    }
+    return -1;
+}
+
+/*
+ * parse_growth - Reads a -r spec into g, returning -1 if it is malformed
+ */
+static int parse_growth(growth_t *g, char *spec)
+{
+    char kind[MAXLINE];
+    int n;
+
+    g->every = GROW_EVERY;
+    if (strlen(spec) >= MAXLINE)
+	return -1;
+    n = sscanf(spec, "%lf:%[a-z]:%lf:%lf", &g->frac, kind, &g->amount, &g->every);
+    if ((n < 3) || (g->frac < 0) || (g->frac > 1) || (g->every < 1))
+	return -1;
+    if (strcmp(kind, "linear") == 0)
+	g->kind = GROW_LINEAR;
+    else if ((strcmp(kind, "geom") == 0) && (g->amount >= 1))
+	g->kind = GROW_GEOM;
+    else
+	return -1;
+    return 0;
+}
+
+/*
+ * read_hist - Reads the "<size> <weight>" lines of a histogram file,
+ *     skipping blank lines and lines that start with '#'
+ */
+static void read_hist(sizedist_t *d, char *path)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    double weight, total = 0;
+    int size, max_bins = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(line, "Could not open %s in read_hist", path);
+	unix_error(line);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if ((line[0] == '#') || (sscanf(line, "%d %lf", &size, &weight) != 2))
+	    continue;
+	if ((size < 1) || (weight <= 0))
+	    continue;
+	if (d->num_bins == max_bins) {
+	    max_bins = max_bins ? 2 * max_bins : 64;
+	    if (((d->bin_sizes = realloc(d->bin_sizes, max_bins * sizeof(int))) == NULL) ||
+		((d->bin_cum = realloc(d->bin_cum, max_bins * sizeof(double))) == NULL))
+		unix_error("realloc failed in read_hist");
+	}
+	total += weight;
+	d->bin_sizes[d->num_bins] = size;
+	d->bin_cum[d->num_bins++] = total;
+    }
+    fclose(fp);
+    if (d->num_bins == 0) {
+	fprintf(stderr, "No \"<size> <weight>\" lines in %s\n", path);
+	exit(1);
+    }
+}
+
+/*
+ * draw_size - Returns a request size drawn from d
+ */
+static int draw_size(sizedist_t *d)
+{
+    double u = rnd(), x, e;
+    int lo, hi, mid;
+
+    switch (d->kind) {
+    case SIZE_UNIFORM:
+	x = d->a + u * (d->b - d->a + 1);
+	break;
+    case SIZE_POWER: /* inverse of the truncated power-law CDF */
+	if (fabs(d->a - 1) < 1e-9)
+	    x = d->b * pow(d->c / d->b, u);
+	else {
+	    e = 1 - d->a;
+	    x = pow(pow(d->b, e) + u * (pow(d->c, e) - pow(d->b, e)), 1 / e);
+	}
+	break;
+    case SIZE_BIMODAL:
+	x = ((rnd() < d->c) ? d->a : d->b) * (0.75 + 0.5 * u);
+	break;
+    default: /* SIZE_HIST: binary search of the cumulative weights */
+	u *= d->bin_cum[d->num_bins - 1];
+	lo = 0;
+	hi = d->num_bins - 1;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (d->bin_cum[mid] < u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	return d->bin_sizes[lo];
+    }
+    if (x < 1)
+	return 1;
+    return (x >= (1 << 30)) ? (1 << 30) : (int)x;
+}
+
+/*
+ * draw_death - Returns the tick a block allocated at tick now dies at
+ */
+static long long draw_death(lifetime_t *l, long long now)
+{
+    double span;
+
+    switch (l->kind) {
+    case LIFE_EXP:
+	span = -l->a * log(rnd());
+	break;
+    case LIFE_PARETO:
+	span = l->b / pow(rnd(), 1 / l->a);
+	break;
+    default: /* LIFE_PHASE */
+	return (now / (long long)l->a + 1) * (long long)l->a;
+    }
+    return (span >= (double)(NEVER / 2)) ? NEVER / 2 : now + 1 + (long long)span;
+}
+
+/*
+ * draw_grow - Returns the tick a growing block is reallocated at next
+ */
+static long long draw_grow(growth_t *g, long long now)
+{
+    return now + 1 + (long long)(-g->every * log(rnd()));
+}
+
+/*
+ * heap_push - Adds block id, whose next event is at tick when, to the
+ *     event heap
+ */
+static void heap_push(long long when, int id)
+{
+    static int max_heap = 0;
+    int i, parent;
+
+    if (heap_size == max_heap) {
+	max_heap = max_heap ? 2 * max_heap : 4096;
+	if ((heap = realloc(heap, max_heap * sizeof(event_t))) == NULL)
+	    unix_error("realloc failed in heap_push");
+    }
+    for (i = heap_size++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (heap[parent].when <= when)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i].when = when;
+    heap[i].id = id;
+}
+
+/*
+ * heap_pop - Removes and returns the earliest event of the event heap
+ */
+static event_t heap_pop(void)
+{
+    event_t top = heap[0], last = heap[--heap_size];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < heap_size) {
+	if ((child + 1 < heap_size) && (heap[child + 1].when < heap[child].when))
+	    child++;
+	if (last.when <= heap[child].when)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * emit - Appends a request to the trace
+ */
+static void emit(int type, int id, int size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : 65536;
+	if ((ops = realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("realloc failed in emit");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops++].size = size;
+}
+
+/*
+ * write_rep - Writes the trace as a text .rep file, with the peak live
+ *     payload as its suggested heap size
+ */
+static void write_rep(char *path, size_t peak)
+{
+    FILE *out;
+    char buf[MAXLINE];
+    int i;
+
+    if ((out = fopen(path, "w")) == NULL) {
+	sprintf(buf, "Could not create %s in write_rep", path);
+	unix_error(buf);
+    }
+    fprintf(out, "%lu\n%d\n%d\n%d\n", (unsigned long)peak, num_ids, num_ops, 1);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == ALLOC)
+	    fprintf(out, "a %u %d\n", ops[i].index, ops[i].size);
+	else if (ops[i].type == REALLOC)
+	    fprintf(out, "r %u %d\n", ops[i].index, ops[i].size);
+	else
+	    fprintf(out, "f %u\n", ops[i].index);
+    }
+    if (fclose(out) != 0)
+	unix_error("write failed in write_rep");
+}
+
+/*
+ * write_bin - Writes the trace in the binary format mdriver maps
+ */
+static void write_bin(char *path, size_t peak)
+{
+    FILE *out;
+    bintrace_t bin;
+    char buf[MAXLINE];
+
+    memcpy(bin.magic, BINTRACE_MAGIC, sizeof(bin.magic));
+    bin.sugg_heapsize = (peak > (size_t)0x7fffffff) ? 0x7fffffff : (int)peak;
+    bin.num_ids = num_ids;
+    bin.num_ops = num_ops;
+    bin.weight = 1;
+
+    if ((out = fopen(path, "w")) == NULL) {
+	sprintf(buf, "Could not create %s in write_bin", path);
+	unix_error(buf);
+    }
+    if ((fwrite(&bin, sizeof(bin), 1, out) != 1) ||
+	(fwrite(ops, sizeof(traceop_t), num_ops, out) != (size_t)num_ops) ||
+	(fclose(out) != 0))
+	unix_error("write failed in write_bin");
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-hvB] [-n <ops>] [-s <sizes>] [-l <lifetimes>] [-r <growth>]\n");
+    fprintf(stderr, "                [-m <bytes>] [-S <seed>] <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-B          Write a binary trace instead of a .rep file.\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-l <model>  Lifetimes in requests: exp:<mean>, pareto:<alpha>:<min>\n");
+    fprintf(stderr, "\t            or phase:<len> (default exp:1000).\n");
+    fprintf(stderr, "\t-m <bytes>  Keep at most <bytes> of payload live (default MAX_HEAP/2).\n");
+    fprintf(stderr, "\t-n <ops>    Generate <ops> requests, or one fewer (default 100000).\n");
+    fprintf(stderr, "\t-r <growth> Grow a fraction of the blocks: <frac>:linear:<bytes> or\n");
+    fprintf(stderr, "\t            <frac>:geom:<factor>, with :<every> requests between\n");
+    fprintf(stderr, "\t            reallocs on average (default none).\n");
+    fprintf(stderr, "\t-s <dist>   Sizes: uniform:<min>:<max>, power:<alpha>:<min>:<max>,\n");
+    fprintf(stderr, "\t            bimodal:<small>:<large>:<p> or hist:<file>\n");
+    fprintf(stderr, "\t            (default power:1.5:8:4096).\n");
+    fprintf(stderr, "\t-S <seed>   Seed the random number generator.\n");
+    fprintf(stderr, "\t-v          Print a summary of the trace.\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
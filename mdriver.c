@@ -14,11 +14,18 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "trace.h"
 #include "config.h"
 
 /**********************
@@ -29,28 +36,36 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define REPLAY_RUNS    3 /* timed runs of a threaded replay, fastest reported */
+#define LATENCY_RUNS  10 /* instrumented runs whose latencies are pooled (-L) */
+#define STREAM_CHUNK 65536 /* requests per buffer of a streamed replay (-S) */
+#define RANGE_CHUNK  4096 /* range records the pool allocates at once */
+#define TOUCH_LINE     64 /* cache line size a touched replay (-U) assumes */
+
+/* Latency histograms: LAT_SUB linear sub-buckets per power of 2 */
+#define LAT_SUBBITS    4
+#define LAT_SUB        (1 << LAT_SUBBITS)
+#define LAT_BUCKETS    ((64 - LAT_SUBBITS + 1) * LAT_SUB)
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload, as a node of a treap
+ * ordered by address
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges at lower addresses */
+    struct range_t *right; /* ranges at higher addresses, or next free record */
+    unsigned int priority; /* random heap priority that keeps the tree balanced */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -58,6 +73,7 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    size_t map_size;     /* if nonzero, ops is mapped from a binary trace */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
@@ -79,12 +95,76 @@ typedef struct {
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
 
+    double cv;       /* std deviation of the timed runs over their mean */
+    double ci;       /* 95% confidence half-width of their mean, over it */
+
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
-    /* Note: secs and util are only defined if valid is true */
+    /* Note: secs, cv, ci and util are only defined if valid is true */
 } stats_t; 
 
+/* One mm configuration tried by a parameter sweep (-X) */
+typedef struct {
+    mm_opts_t opts;     /* the configuration */
+    double util;        /* average space utilization over the traces */
+    double kops;        /* throughput over all the traces, in Kops/sec */
+    double perfindex;   /* performance index of util and throughput */
+    int valid;          /* were all the traces processed correctly? */
+    int pareto;         /* is no other configuration better at both? */
+} sweep_result_t;
+
+/* The values a sweep tries for one mm_opts_t field (-O name) */
+typedef struct {
+    char *name;
+    char *values[6];    /* null-terminated */
+} sweep_param_t;
+
+/* Holds the state of one thread of a multi-threaded replay (-j) */
+typedef struct {
+    trace_t *trace;       /* trace being replayed */
+    int tid;              /* thread number */
+    int *opnums;          /* requests this thread replays, in trace order */
+    int num_ops;          /* number of entries in opnums */
+    char **blocks;        /* this thread's block pointers ... */
+    size_t *block_sizes;  /* ... and their payload sizes */
+    int check;            /* if set, check every block instead of timing */
+    pthread_barrier_t *start; /* releases all threads at once */
+    double begin, end;    /* when this thread started and finished its requests */
+    size_t peak;          /* peak payload bytes this thread had allocated */
+    int badop;            /* -1, or the request the allocator got wrong */
+    int oom;              /* set if the heap ran out before the trace did */
+    char *msg;            /* what went wrong at badop */
+} replay_t;
+
+/* The two buffers a streamed replay (-S) passes between its threads */
+typedef struct {
+    FILE *file;                /* trace being streamed */
+    int binary;                /* it holds binary records after its header */
+    traceop_t *bufs[2];        /* requests read ahead of the replay */
+    int counts[2];             /* requests in each buffer, 0 at end of trace */
+    int full[2];               /* buffer is loaded and not yet replayed */
+    int stop;                  /* the replay gave up, so stop reading */
+    pthread_mutex_t lock;      /* guards counts, full and stop */
+    pthread_cond_t cond;       /* signalled whenever a buffer changes hands */
+} stream_t;
+
+/* Live blocks of a streamed replay, hashed by id, as it has no num_ids */
+typedef struct {
+    unsigned int *ids;         /* id + 1 of each slot, 0 if the slot is empty */
+    char **blocks;             /* payload of each slot ... */
+    int *sizes;                /* ... and its size */
+    unsigned int mask;         /* number of slots - 1, a power of 2 minus 1 */
+    unsigned int used;         /* occupied slots */
+} blockmap_t;
+
+/* Log-bucketed histogram of per-request latencies, in timer ticks */
+typedef struct {
+    unsigned long long counts[LAT_BUCKETS]; /* samples per bucket */
+    unsigned long long total;               /* number of samples */
+    unsigned long long max;                 /* largest sample */
+} hist_t;
+
 /********************
  * Global variables
  *******************/
@@ -92,9 +172,57 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+static int num_threads = 1; /* threads in a multi-threaded replay (-j) */
+static int partition = 0;   /* if set, threads split a trace instead of copying it (-p) */
+static int run_latency = 0; /* if set, print per-request latency percentiles (-L) */
+static int run_stats = 0;   /* if set, print the allocator's statistics (-s) */
+static int touch = 0;       /* if set, timed replays touch every payload (-U) */
+static volatile unsigned char touch_sink; /* keeps the reads of touched payloads */
+static mm_opts_t mm_opts = MM_OPTS_DEFAULT; /* placement policy of every mm heap (-P, -b) */
+
+/* The baseline allocator -l replays the traces on: libc, or one loaded with -A */
+static char *base_name = "libc";
+static void *(*base_malloc)(size_t) = malloc;
+static void (*base_free)(void *) = free;
+static void *(*base_realloc)(void *, size_t) = realloc;
+
+static range_t *range_pool;       /* free range records, linked through right */
+static unsigned int range_seed = 1; /* xorshift state for treap priorities */
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* How the speed runs are timed (-T, -W) */
+static int timer = USE_FCYC ? FSECS_FCYC : USE_ITIMER ? FSECS_ITIMER : FSECS_GETTOD;
+static int cache_mode = FSECS_PLAIN;
+
+/* Names of the FSECS_* timing methods and cache modes, in order */
+static char *timer_names[] = {"gettod", "itimer", "fcyc"};
+static char *cache_names[] = {"warm", "cold", "plain"};
+
+/* Two-sided 95% quantiles of Student's t, by degrees of freedom - 1 */
+static double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+#define T95_DFS (int)(sizeof(t95) / sizeof(double))
+
+/* Names of the MM_FIT_* placement policies, in order */
+static char *fit_names[] = {"best", "first", "next", "good"};
+
+/* The mm_opts_t fields a sweep varies, unless fixed with -O */
+static sweep_param_t sweep_params[] = {
+    {"fit",        {"best", "first", "next", "good", NULL}},
+    {"candidates", {"1", "4", "16", NULL}},
+    {"back",       {"64", "100", "256", "1048576", NULL}},
+    {"split",      {"16", "24", "48", NULL}},
+    {"chunk",      {"1024", "4096", "16384", NULL}},
+    {"initchunk",  {"64", "4096", NULL}},
+    {"reallocbuf", {"0", "100", "128", "512", NULL}},
+};
+#define SWEEP_PARAMS (int)(sizeof(sweep_params) / sizeof(sweep_param_t))
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -114,10 +242,20 @@ static void clear_ranges(range_t **ranges);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static trace_t *map_trace(char *path);
+static void write_trace(trace_t *trace, char *path);
+
+/* Routines for timing a trace and summing the spread of the timings */
+static void time_trace(fsecs_test_funct f, speed_t *params, stats_t *stats);
+static void total_spread(int n, stats_t *stats, double *cv, double *ci);
+
+/* Touches a payload the way a program would */
+static unsigned char touch_payload(char *p, size_t size, int write);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void load_baseline(char *path);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
@@ -125,6 +263,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for replaying a trace on several threads at once */
+static void *replay_thread(void *ptr);
+static int eval_mm_threads(trace_t *trace, int tracenum);
+
+/* Routines for measuring the latency of each request */
+static void eval_mm_latency(trace_t *trace, int tracenum);
+
+/* Routine for reporting the allocator's own counters */
+static void eval_mm_stats(trace_t *trace, int tracenum);
+
+/* Routines for scoring mm configurations and sweeping over them */
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats);
+static double perf_index(double util, double throughput, double *p1, double *p2);
+static int set_mm_opt(mm_opts_t *opts, char *name, char *value);
+static int parse_mm_opts(mm_opts_t *opts, char *spec, unsigned int *fixed);
+static int parse_fit(mm_opts_t *opts, char *spec);
+static void format_mm_opts(mm_opts_t *opts, char *buf);
+static void eval_mm_sweep(char **tracefiles, int n, char *spec,
+			  unsigned int fixed, char *outfile);
+static void write_sweep(char *outfile, sweep_result_t *results, int count);
+static void write_trace_results(FILE *fp, int json, char *name, char **tracefiles,
+				int n, stats_t *stats, double perfindex);
+static void write_results(char *outfile, char **tracefiles, int n,
+			  stats_t *mm_results, stats_t *base_results, double perfindex);
+
+/* Routines for replaying a trace while it is being read */
+static void *stream_reader(void *ptr);
+static int eval_mm_stream(char *tracedir, char *filename, int tracenum);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
 static void usage(void);
@@ -142,7 +309,6 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,6 +316,11 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    char *binfile = NULL;/* If set, convert the trace to this binary file (-B) */
+    int stream = 0;      /* If set, only stream the traces through mm (-S) */
+    char *sweep = NULL;  /* If set, sweep mm configurations this way (-X) */
+    char *outfile = NULL;/* If set, write the results here (-o) */
+    unsigned int fixed = 0; /* sweep_params fixed with -O, one bit each */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +329,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalj:pLB:SC:sUP:b:O:X:o:A:T:W:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +355,91 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'A': /* Run this malloc-compatible library instead of libc */
+            load_baseline(optarg);
+            run_libc = 1;
+            break;
+        case 'j': /* Also replay each trace on this many threads */
+            num_threads = atoi(optarg);
+            if (num_threads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'p': /* Split the trace among the threads */
+            partition = 1;
+            break;
+        case 'L': /* Print per-request latency percentiles */
+            run_latency = 1;
+            break;
+        case 's': /* Print allocator statistics */
+            run_stats = 1;
+            break;
+        case 'U': /* Touch the payloads in the timed replays */
+            touch = 1;
+            break;
+        case 'P': /* Placement policy, with an optional candidate bound */
+            if (parse_fit(&mm_opts, optarg) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'b': /* Back-placement threshold */
+            mm_opts.back_place_min = atoi(optarg);
+            break;
+        case 'O': /* Set any mm option, as name=value[,name=value...] */
+            if (parse_mm_opts(&mm_opts, optarg, &fixed) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'X': /* Sweep mm configurations over the traces */
+            sweep = optarg;
+            break;
+        case 'o': /* Machine-readable output file */
+            outfile = optarg;
+            break;
+        case 'B': /* Convert the -f trace to a binary trace file */
+            binfile = optarg;
+            break;
+        case 'S': /* Replay the traces while reading them */
+            stream = 1;
+            break;
+        case 'C': /* Check the heap after every request */
+            if (strcmp(optarg, "full") == 0)
+                mm_check_mode(MM_CHECK_FULL, 1);
+            else if (strcmp(optarg, "incremental") == 0)
+                mm_check_mode(MM_CHECK_INCREMENTAL, 1);
+            else if (atoi(optarg) > 0)
+                mm_check_mode(MM_CHECK_SAMPLED, atoi(optarg));
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Timing method, with an optional CPU to pin it to */
+            for (timer = 0; timer <= FSECS_FCYC; timer++)
+                if (strncmp(optarg, timer_names[timer], strlen(timer_names[timer])) == 0)
+                    break;
+            if (timer > FSECS_FCYC) {
+                usage();
+                exit(1);
+            }
+            set_fsecs_method(timer, (strchr(optarg, ':') != NULL) ?
+                             atoi(strchr(optarg, ':') + 1) : -1);
+            break;
+        case 'W': /* Start timed runs warm, or cold with this much evicted */
+            if (strncmp(optarg, "warm", 4) == 0)
+                cache_mode = FSECS_WARM;
+            else if (strncmp(optarg, "cold", 4) == 0)
+                cache_mode = FSECS_COLD;
+            else {
+                usage();
+                exit(1);
+            }
+            set_fsecs_cache(cache_mode, (strchr(optarg, ':') != NULL) ?
+                            atoi(strchr(optarg, ':') + 1) : 0);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +455,26 @@ int main(int argc, char **argv)
         }
     }
 	
+    /* A preloaded allocator has taken over libc's malloc */
+    if ((strcmp(base_name, "libc") == 0) && (getenv("LD_PRELOAD") != NULL) &&
+        (*getenv("LD_PRELOAD") != '\0'))
+	base_name = (strrchr(getenv("LD_PRELOAD"), '/') != NULL) ?
+	    strrchr(getenv("LD_PRELOAD"), '/') + 1 : getenv("LD_PRELOAD");
+
+    /*
+     * Convert a trace to the binary format and do nothing else
+     */
+    if (binfile != NULL) {
+	if (num_tracefiles != 1) {
+	    fprintf(stderr, "-B needs the trace to convert given with -f\n");
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, binfile);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -231,12 +507,25 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /*
+     * Optionally just stream each trace through the mm package, for
+     * traces too large to load
+     */
+    if (stream) {
+	mem_init();
+	printf("%5s%8s%12s%10s%8s%10s\n",
+	       "trace", " valid", "ops", "secs", "Kops", "stalled");
+	for (i = 0; i < num_tracefiles; i++)
+	    eval_mm_stream(tracedir, tracefiles[i], i);
+	exit(errors ? 1 : 0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
     if (run_libc) {
 	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
+	    printf("\nTesting %s malloc\n", base_name);
 	
 	/* Allocate libc stats array, with one stats_t struct per tracefile */
 	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
@@ -248,20 +537,20 @@ int main(int argc, char **argv)
 	    trace = read_trace(tracedir, tracefiles[i]);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
+		printf("Checking %s malloc for correctness, ", base_name);
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		time_trace(eval_libc_speed, &speed_params, &libc_stats[i]);
 	    }
 	    free_trace(trace);
 	}
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
+	    printf("\nResults for %s malloc:\n", base_name);
 	    printresults(num_tracefiles, libc_stats);
 	}
     }
@@ -280,28 +569,16 @@ int main(int argc, char **argv)
 	/* Initialize the simulated memory system in memlib.c */
 	mem_init();
 
-	/* Evaluate student's mm malloc package using the K-best scheme */
-	for (i = 0; i < num_tracefiles; i++)
-	{
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-		printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid)
+	/* Optionally score many configurations instead of just this one */
+	if (sweep != NULL)
 	{
-		if (verbose > 1)
-		printf("efficiency, ");
-		mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-		speed_params.trace = trace;
-		speed_params.ranges = ranges;
-		if (verbose > 1)
-		printf("and performance.\n");
-		mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+	eval_mm_sweep(tracefiles, num_tracefiles, sweep, fixed, outfile);
+	exit(0);
 	}
 
+	/* Evaluate student's mm malloc package using the K-best scheme */
+	eval_mm_traces(tracefiles, num_tracefiles, mm_stats);
+
 	/* Display the mm results in a compact table */
 	if (verbose)
 	{
@@ -310,6 +587,47 @@ int main(int argc, char **argv)
 	printf("\n");
 	}
 
+	/*
+	 * Optionally replay every trace on several threads at once
+	 */
+	if (num_threads > 1)
+	{
+	for (i = 0; i < num_tracefiles; i++)
+	{
+		trace = read_trace(tracedir, tracefiles[i]);
+		eval_mm_threads(trace, i);
+		free_trace(trace);
+	}
+	printf("\n");
+	}
+
+	/*
+	 * Optionally time every request of every trace
+	 */
+	if (run_latency)
+	{
+	for (i = 0; i < num_tracefiles; i++)
+	{
+		trace = read_trace(tracedir, tracefiles[i]);
+		eval_mm_latency(trace, i);
+		free_trace(trace);
+	}
+	printf("\n");
+	}
+
+	/*
+	 * Optionally report the allocator's own counters for every trace
+	 */
+	if (run_stats)
+	{
+	for (i = 0; i < num_tracefiles; i++)
+	{
+		trace = read_trace(tracedir, tracefiles[i]);
+		eval_mm_stats(trace, i);
+		free_trace(trace);
+	}
+	}
+
 	/*
 	 * Accumulate the aggregate statistics for the student's mm package
 	 */
@@ -333,19 +651,7 @@ int main(int argc, char **argv)
 	if (errors == 0)
 	{
 	avg_mm_throughput = ops / secs;
-
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT)
-	{
-		p2 = (double)(1.0 - UTIL_WEIGHT);
-	}
-	else
-	{
-		p2 = ((double)(1.0 - UTIL_WEIGHT)) *
-			 (avg_mm_throughput / AVG_LIBC_THRUPUT);
-	}
-
-	perfindex = (p1 + p2) * 100.0;
+	perfindex = perf_index(avg_mm_util, avg_mm_throughput, &p1, &p2);
 	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
 		   p1 * 100,
 		   p2 * 100,
@@ -357,6 +663,9 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
 	}
 
+	if (outfile != NULL)
+	write_results(outfile, tracefiles, num_tracefiles, mm_stats, libc_stats, perfindex);
+
 	if (autograder)
 	{
 	printf("correct:%d\n", numcorrect);
@@ -367,16 +676,104 @@ int main(int argc, char **argv)
 }
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is a
+ * treap keyed on the low address, so each check, insert and removal
+ * takes expected O(log n) time, and its records come from a pool.
  ****************************************************************/
 
+/*
+ * range_alloc - Takes a record from the pool, refilling the pool
+ *     RANGE_CHUNK records at a time
+ */
+static range_t *range_alloc(void)
+{
+	range_t *p;
+	int i;
+
+	if (range_pool == NULL)
+	{
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+		unix_error("malloc error in range_alloc");
+	for (i = 0; i < RANGE_CHUNK; i++)
+	{
+		p[i].right = range_pool;
+		range_pool = &p[i];
+	}
+	}
+	p = range_pool;
+	range_pool = p->right;
+	return p;
+}
+
+/*
+ * range_release - Returns a record to the pool
+ */
+static void range_release(range_t *p)
+{
+	p->right = range_pool;
+	range_pool = p;
+}
+
+/*
+ * range_insert - Inserts node into the treap rooted at root and
+ *     returns the new root
+ */
+static range_t *range_insert(range_t *root, range_t *node)
+{
+	range_t *child;
+
+	if (root == NULL)
+	return node;
+
+	if (node->lo < root->lo)
+	{
+	child = root->left = range_insert(root->left, node);
+	if (child->priority > root->priority)
+	{ /* rotate right */
+		root->left = child->right;
+		child->right = root;
+		return child;
+	}
+	}
+	else
+	{
+	child = root->right = range_insert(root->right, node);
+	if (child->priority > root->priority)
+	{ /* rotate left */
+		root->right = child->left;
+		child->left = root;
+		return child;
+	}
+	}
+	return root;
+}
+
+/*
+ * range_merge - Joins two treaps, every range of a below every range
+ *     of b, and returns the new root
+ */
+static range_t *range_merge(range_t *a, range_t *b)
+{
+	if (a == NULL)
+	return b;
+	if (b == NULL)
+	return a;
+	if (a->priority > b->priority)
+	{
+	a->right = range_merge(a->right, b);
+	return a;
+	}
+	b->left = range_merge(a, b->left);
+	return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
 					 int tracenum, int opnum)
@@ -396,9 +793,10 @@ static int add_range(range_t **ranges, char *lo, int size,
 	return 0;
 	}
 
-	/* The payload must lie within the extent of the heap */
-	if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-		(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))
+	/* The payload must lie within the extent of the heap, or of a mapping */
+	if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+		 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+		!mem_is_mapped(lo, hi))
 	{
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 			lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -406,11 +804,14 @@ static int add_range(range_t **ranges, char *lo, int size,
 	return 0;
 	}
 
-	/* The payload must not overlap any other payloads */
-	for (p = *ranges; p != NULL; p = p->next)
+	/*
+	 * The payload must not overlap any other payloads. The ranges are
+	 * disjoint, so only its neighbours in address order can overlap
+	 * it, and both lie on the search path for lo.
+	 */
+	for (p = *ranges; p != NULL; p = (lo < p->lo) ? p->left : p->right)
 	{
-	if ((lo >= p->lo && lo <= p->hi) ||
-		(hi >= p->lo && hi <= p->hi))
+	if ((lo < p->lo) ? (hi >= p->lo) : (lo <= p->hi))
 	{
 		sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
 				lo, hi, p->lo, p->hi);
@@ -421,14 +822,17 @@ static int add_range(range_t **ranges, char *lo, int size,
 
 	/*
 	 * Everything looks OK, so remember the extent of this block
-	 * by creating a range struct and adding it the range list.
+	 * by creating a range struct and adding it the range tree.
 	 */
-	if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-	p->next = *ranges;
+	p = range_alloc();
 	p->lo = lo;
 	p->hi = hi;
-	*ranges = p;
+	p->left = p->right = NULL;
+	range_seed ^= range_seed << 13;
+	range_seed ^= range_seed >> 17;
+	range_seed ^= range_seed << 5;
+	p->priority = range_seed;
+	*ranges = range_insert(*ranges, p);
 	return 1;
 }
 
@@ -438,19 +842,19 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
 	range_t *p;
-	range_t **prevpp = ranges;
-	int size;
 
-	for (p = *ranges; p != NULL; p = p->next)
+	while ((p = *ranges) != NULL)
 	{
-	if (p->lo == lo)
+	if (lo < p->lo)
+		ranges = &p->left;
+	else if (lo > p->lo)
+		ranges = &p->right;
+	else
 	{
-		*prevpp = p->next;
-		size = p->hi - p->lo + 1;
-		free(p);
+		*ranges = range_merge(p->left, p->right);
+		range_release(p);
 		break;
 	}
-	prevpp = &(p->next);
 	}
 }
 
@@ -459,14 +863,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-	range_t *p;
-	range_t *pnext;
+	range_t *p = *ranges;
 
-	for (p = *ranges; p != NULL; p = pnext)
-	{
-	pnext = p->next;
-	free(p);
-	}
+	if (p == NULL)
+	return;
+	clear_ranges(&p->left);
+	clear_ranges(&p->right);
+	range_release(p);
 	*ranges = NULL;
 }
 
@@ -486,6 +889,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	unsigned index, size;
 	unsigned max_index = 0;
 	unsigned op_index;
+	bintrace_t bin;
 
 	if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -502,6 +906,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
 	}
+
+	/* A binary trace is mapped instead of being parsed */
+	if ((fread(&bin, sizeof(bin), 1, tracefile) == 1) &&
+		!memcmp(bin.magic, BINTRACE_MAGIC, sizeof(bin.magic)))
+	{
+	fclose(tracefile);
+	free(trace);
+	return map_trace(path);
+	}
+	rewind(tracefile);
 	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
 	fscanf(tracefile, "%d", &(trace->num_ids));
 	fscanf(tracefile, "%d", &(trace->num_ops));
@@ -559,16 +973,92 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	assert(max_index == trace->num_ids - 1);
 	assert(trace->num_ops == op_index);
 
+	trace->map_size = 0;
+	return trace;
+}
+
+/*
+ * map_trace - Maps a binary trace file, whose header read_trace has
+ *     already recognized, and uses its records as the ops array in
+ *     place. The mapping is read-only and shared, so repeated runs and
+ *     concurrent mdrivers all use the same page-cache pages.
+ */
+static trace_t *map_trace(char *path)
+{
+	trace_t *trace;
+	bintrace_t *bin;
+	struct stat st;
+	int fd;
+
+	if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in map_trace");
+
+	if (((fd = open(path, O_RDONLY)) < 0) || (fstat(fd, &st) < 0))
+	{
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+	}
+	bin = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bin == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+	madvise(bin, st.st_size, MADV_WILLNEED);
+
+	trace->sugg_heapsize = bin->sugg_heapsize;
+	trace->num_ids = bin->num_ids;
+	trace->num_ops = bin->num_ops;
+	trace->weight = bin->weight;
+	trace->ops = (traceop_t *)(bin + 1);
+	trace->map_size = st.st_size;
+	if ((trace->num_ops < 0) || (trace->num_ids < 0) ||
+		(st.st_size != sizeof(bintrace_t) + (off_t)trace->num_ops * sizeof(traceop_t)))
+	{
+	sprintf(msg, "Truncated or corrupt binary trace %s", path);
+	app_error(msg);
+	}
+
+	if (((trace->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL) ||
+		((trace->block_sizes = (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL))
+	unix_error("malloc 2 failed in map_trace");
+
 	return trace;
 }
 
+/*
+ * write_trace - Writes a trace in the binary format that map_trace reads
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+	FILE *out;
+	bintrace_t bin;
+
+	memcpy(bin.magic, BINTRACE_MAGIC, sizeof(bin.magic));
+	bin.sugg_heapsize = trace->sugg_heapsize;
+	bin.num_ids = trace->num_ids;
+	bin.num_ops = trace->num_ops;
+	bin.weight = trace->weight;
+
+	if ((out = fopen(path, "w")) == NULL)
+	{
+	sprintf(msg, "Could not create %s in write_trace", path);
+	unix_error(msg);
+	}
+	if ((fwrite(&bin, sizeof(bin), 1, out) != 1) ||
+		(fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, out) != (size_t)trace->num_ops) ||
+		(fclose(out) != 0))
+	unix_error("write failed in write_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-	free(trace->ops); /* free the three arrays... */
+	if (trace->map_size) /* unmap or free the three arrays... */
+	munmap((bintrace_t *)trace->ops - 1, trace->map_size);
+	else
+	free(trace->ops);
 	free(trace->blocks);
 	free(trace->block_sizes);
 	free(trace); /* and the trace record itself... */
@@ -597,7 +1087,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	clear_ranges(ranges);
 
 	/* Call the mm package's init function */
-	if (mm_init() < 0)
+	if (mm_init_opts(&mm_opts) < 0)
 	{
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
@@ -668,7 +1158,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		oldsize = size;
 		for (j = 0; j < oldsize; j++)
 		{
-		if (newp[j] != (index & 0xFF))
+		if ((unsigned char)newp[j] != (index & 0xFF))
 		{
 			malloc_error(tracenum, i, "mm_realloc did not preserve the "
 									  "data from old block");
@@ -704,10 +1194,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size the heap reached while running the student's malloc
+ *   package on the trace. mem_sbrk() lets the package decrement the
+ *   brk pointer, so the final brk may lie below that high water mark.
  *
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -722,7 +1211,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
 	/* initialize the heap and the mm malloc package */
 	mem_reset_brk();
-	if (mm_init() < 0)
+	if (mm_init_opts(&mm_opts) < 0)
 	app_error("mm_init failed in eval_mm_util");
 
 	for (i = 0; i < trace->num_ops; i++)
@@ -788,7 +1277,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	}
 	}
 
-	return ((double)max_total_size / (double)mem_heapsize());
+	return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 /*
@@ -799,11 +1288,12 @@ static void eval_mm_speed(void *ptr)
 {
 	int i, index, size, newsize;
 	char *p, *newp, *oldp, *block;
+	unsigned char seen = 0;
 	trace_t *trace = ((speed_t *)ptr)->trace;
 
 	/* Reset the heap and initialize the mm package */
 	mem_reset_brk();
-	if (mm_init() < 0)
+	if (mm_init_opts(&mm_opts) < 0)
 	app_error("mm_init failed in eval_mm_speed");
 
 	/* Interpret each trace request */
@@ -817,6 +1307,11 @@ static void eval_mm_speed(void *ptr)
 		if ((p = mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
 		trace->blocks[index] = p;
+		if (touch)
+		{
+			trace->block_sizes[index] = size;
+			touch_payload(p, size, 1);
+		}
 		break;
 
 	case REALLOC: /* mm_realloc */
@@ -826,108 +1321,1463 @@ static void eval_mm_speed(void *ptr)
 		if ((newp = mm_realloc(oldp, newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
 		trace->blocks[index] = newp;
+		if (touch)
+		{
+			trace->block_sizes[index] = newsize;
+			touch_payload(newp, newsize, 1);
+		}
 		break;
 
 	case FREE: /* mm_free */
 		index = trace->ops[i].index;
 		block = trace->blocks[index];
+		if (touch)
+			seen += touch_payload(block, trace->block_sizes[index], 0);
 		mm_free(block);
 		break;
 
 	default:
 		app_error("Nonexistent request type in eval_mm_valid");
 	}
+	touch_sink = seen;
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * touch_payload - Writes a byte in every cache line of a payload, as a
+ *    program filling a new block would, or with write 0 reads them back
+ *    as one would before freeing it. Returns the sum of the bytes read.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static unsigned char touch_payload(char *p, size_t size, int write)
 {
-	int i, newsize;
-	char *p, *newp, *oldp;
+	char *end = p + size;
+	unsigned char sum = 0;
 
-	for (i = 0; i < trace->num_ops; i++)
-	{
-	switch (trace->ops[i].type)
+	/* One access per line, however the payload straddles the lines */
+	for (; p < end; p = (char *)(((unsigned long)p | (TOUCH_LINE - 1)) + 1))
 	{
+		if (write)
+			*p = (char)size;
+		else
+			sum += *(unsigned char *)p;
+	}
+	return sum;
+}
 
-	case ALLOC: /* malloc */
-		if ((p = malloc(trace->ops[i].size)) == NULL)
+/*
+ * replay_clock - Returns a monotonic timestamp in seconds
+ */
+static double replay_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * replay_thread - Runs one thread's share of a threaded replay. In check
+ *    mode every payload must be aligned and inside the heap, and keeps
+ *    a per-thread mark in its first and last byte that other threads
+ *    must not overwrite; otherwise the requests are only timed.
+ */
+static void *replay_thread(void *ptr)
+{
+	replay_t *r = (replay_t *)ptr;
+	traceop_t *op;
+	int i, index, size;
+	size_t live = 0;
+	unsigned char mark, seen = 0;
+	char *p, *oldp;
+
+	pthread_barrier_wait(r->start);
+	r->begin = replay_clock();
+
+	for (i = 0; i < r->num_ops; i++)
+	{
+		op = &r->trace->ops[r->opnums[i]];
+		index = op->index;
+		size = op->size;
+		mark = (unsigned char)(r->tid * 67 + index);
+		oldp = r->blocks[index];
+
+		if (r->check && (op->type != ALLOC) &&
+			((*(unsigned char *)oldp != mark) ||
+			 (*(unsigned char *)(oldp + r->block_sizes[index] - 1) != mark)))
 		{
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+			r->badop = r->opnums[i];
+			r->msg = "payload was overwritten by another block";
+			break;
 		}
-		trace->blocks[trace->ops[i].index] = p;
-		break;
 
-	case REALLOC: /* realloc */
-		newsize = trace->ops[i].size;
-		oldp = trace->blocks[trace->ops[i].index];
-		if ((newp = realloc(oldp, newsize)) == NULL)
+		switch (op->type)
 		{
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+		case ALLOC: /* mm_malloc */
+			p = mm_malloc(size);
+			break;
+
+		case REALLOC: /* mm_realloc */
+			p = mm_realloc(oldp, size);
+			live -= r->block_sizes[index];
+			break;
+
+		case FREE: /* mm_free */
+			if (touch)
+				seen += touch_payload(oldp, r->block_sizes[index], 0);
+			mm_free(oldp);
+			live -= r->block_sizes[index];
+			continue;
+
+		default:
+			app_error("Nonexistent request type in replay_thread");
+			return NULL;
 		}
-		trace->blocks[trace->ops[i].index] = newp;
-		break;
-
-	case FREE: /* free */
-		free(trace->blocks[trace->ops[i].index]);
-		break;
 
-	default:
-		app_error("invalid operation type  in eval_libc_valid");
-	}
+		if (p == NULL)
+		{
+			r->oom = 1;
+			break;
+		}
+		r->blocks[index] = p;
+		r->block_sizes[index] = size;
+		live += size;
+		if (live > r->peak)
+			r->peak = live;
+		if (touch)
+			touch_payload(p, size, 1);
+
+		if (r->check)
+		{
+			if (!IS_ALIGNED(p) ||
+				(((p < (char *)mem_heap_lo()) || (p + size - 1 > (char *)mem_heap_hi())) &&
+				 !mem_is_mapped(p, p + size - 1)))
+			{
+				r->badop = r->opnums[i];
+				r->msg = "payload is misaligned or outside the heap";
+				break;
+			}
+			*(unsigned char *)p = mark;
+			*(unsigned char *)(p + size - 1) = mark;
+		}
 	}
 
-	return 1;
+	r->end = replay_clock();
+	touch_sink = seen;
+	return NULL;
 }
 
 /*
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ * eval_mm_threads - Replays a trace on num_threads threads at once, each
+ *    with a copy of the trace or, with -p, with the blocks whose ids
+ *    fall to it. A checked run comes first, then the fastest of
+ *    REPLAY_RUNS timed runs is reported with aggregate throughput and
+ *    each thread's mean latency and peak allocated payload. Running
+ *    out of heap is reported but not counted as an error, since N
+ *    copies of a big trace may simply not fit in MAX_HEAP.
  */
-static void eval_libc_speed(void *ptr)
+static int eval_mm_threads(trace_t *trace, int tracenum)
 {
-	int i;
-	int index, size, newsize;
-	char *p, *newp, *oldp, *block;
-	trace_t *trace = ((speed_t *)ptr)->trace;
+	replay_t *r;
+	pthread_t *tids;
+	pthread_barrier_t start;
+	double begin, end, best = DBL_MAX;
+	double *thread_secs;
+	double ops = 0;
+	size_t heapsize = 0;
+	int i, j, run, oom = 0, valid = 1;
 
-	for (i = 0; i < trace->num_ops; i++)
+	if (((r = calloc(num_threads, sizeof(replay_t))) == NULL) ||
+		((tids = calloc(num_threads, sizeof(pthread_t))) == NULL) ||
+		((thread_secs = calloc(num_threads, sizeof(double))) == NULL))
+	unix_error("calloc in eval_mm_threads failed");
+
+	for (j = 0; j < num_threads; j++)
 	{
-	switch (trace->ops[i].type)
+		r[j].trace = trace;
+		r[j].tid = j;
+		if (((r[j].opnums = malloc(trace->num_ops * sizeof(int))) == NULL) ||
+			((r[j].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL) ||
+			((r[j].block_sizes = calloc(trace->num_ids, sizeof(size_t))) == NULL))
+		unix_error("malloc in eval_mm_threads failed");
+		for (i = 0; i < trace->num_ops; i++)
+		{
+			if (!partition || (trace->ops[i].index % num_threads == j))
+				r[j].opnums[r[j].num_ops++] = i;
+		}
+		ops += r[j].num_ops;
+	}
+
+	/* One checked run, then the timed ones */
+	for (run = 0; valid && (run <= REPLAY_RUNS); run++)
 	{
-	case ALLOC: /* malloc */
-		index = trace->ops[i].index;
-		size = trace->ops[i].size;
-		if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-		trace->blocks[index] = p;
-		break;
+		mem_reset_brk();
+		if (mm_init_opts(&mm_opts) < 0)
+		app_error("mm_init failed in eval_mm_threads");
+		pthread_barrier_init(&start, NULL, num_threads + 1);
 
-	case REALLOC: /* realloc */
-		index = trace->ops[i].index;
+		for (j = 0; j < num_threads; j++)
+		{
+			r[j].check = (run == 0);
+			r[j].start = &start;
+			r[j].badop = -1;
+			r[j].oom = 0;
+			if (pthread_create(&tids[j], NULL, replay_thread, &r[j]) != 0)
+			unix_error("pthread_create in eval_mm_threads failed");
+		}
+		pthread_barrier_wait(&start);
+		for (j = 0; j < num_threads; j++)
+			pthread_join(tids[j], NULL);
+		pthread_barrier_destroy(&start);
+
+		for (j = 0; j < num_threads; j++)
+		{
+			if (r[j].badop >= 0)
+			{
+				sprintf(msg, "thread %d: %s", j, r[j].msg);
+				malloc_error(tracenum, r[j].badop, msg);
+				valid = 0;
+			}
+			oom |= r[j].oom;
+		}
+		if (oom)
+			valid = 0;
+		if (run == 0)
+		{
+			heapsize = mem_peak_heapsize();
+			continue;
+		}
+
+		/* The replay spans the first start to the last finish */
+		begin = r[0].begin;
+		end = r[0].end;
+		for (j = 1; j < num_threads; j++)
+		{
+			begin = (r[j].begin < begin) ? r[j].begin : begin;
+			end = (r[j].end > end) ? r[j].end : end;
+		}
+		if (end - begin < best)
+		{
+			best = end - begin;
+			for (j = 0; j < num_threads; j++)
+				thread_secs[j] = r[j].end - r[j].begin;
+		}
+	}
+
+	/* Display the results of the fastest run */
+	printf("Trace %d on %d threads (%s):\n", tracenum, num_threads,
+		   partition ? "partitioned" : "copies");
+	if (valid)
+	{
+	printf("%6s%8s%10s%8s%10s\n", "thread", "ops", "secs", "ns/op", "peak KB");
+	for (j = 0; j < num_threads; j++)
+	{
+		printf("%6d%8d%10.6f%8.1f%10.1f\n",
+			   j,
+			   r[j].num_ops,
+			   thread_secs[j],
+			   r[j].num_ops ? thread_secs[j] * 1e9 / r[j].num_ops : 0.0,
+			   r[j].peak / 1024.0);
+	}
+	printf("%6s%8.0f%10.6f%8.0f Kops, heap %.1f KB\n",
+		   "Total ",
+		   ops,
+		   best,
+		   (ops / 1e3) / best,
+		   heapsize / 1024.0);
+	}
+	else if (oom)
+	printf("%6s  the copies do not fit in a %d-byte heap\n", "Total ", MAX_HEAP);
+	else
+	printf("%6s%8s%10s%8s Kops\n", "Total ", "-", "-", "-");
+
+	for (j = 0; j < num_threads; j++)
+	{
+		free(r[j].opnums);
+		free(r[j].blocks);
+		free(r[j].block_sizes);
+	}
+	free(thread_secs);
+	free(tids);
+	free(r);
+	return valid;
+}
+
+/*
+ * lat_ticks - Reads the timer used for per-request latencies: the cycle
+ *    counter on x86, the monotonic clock in nanoseconds elsewhere
+ */
+static inline unsigned long long lat_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * lat_calibrate - Returns the nanoseconds per tick of lat_ticks, and the
+ *    ticks a back-to-back pair of reads costs, which every sample
+ *    includes and which is subtracted from it
+ */
+static double lat_calibrate(unsigned long long *overhead)
+{
+	unsigned long long t0, t1, best = ~0ULL;
+	double start;
+	int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		t0 = lat_ticks();
+		t1 = lat_ticks();
+		best = (t1 - t0 < best) ? t1 - t0 : best;
+	}
+	*overhead = best;
+
+	start = replay_clock();
+	t0 = lat_ticks();
+	while (replay_clock() - start < 0.01)
+		;
+	t1 = lat_ticks();
+	return (replay_clock() - start) * 1e9 / (double)(t1 - t0);
+}
+
+/*
+ * hist_record - Adds a sample to a histogram. Values below LAT_SUB get a
+ *    bucket each; above that a bucket spans 1/LAT_SUB of its power of 2.
+ */
+static inline void hist_record(hist_t *h, unsigned long long v)
+{
+	int msb, bucket;
+
+	if (v < LAT_SUB)
+		bucket = (int)v;
+	else
+	{
+		msb = 63 - __builtin_clzll(v);
+		bucket = ((msb - LAT_SUBBITS + 1) << LAT_SUBBITS) +
+			(int)((v >> (msb - LAT_SUBBITS)) & (LAT_SUB - 1));
+	}
+	h->counts[bucket]++;
+	h->total++;
+	if (v > h->max)
+		h->max = v;
+}
+
+/*
+ * hist_percentile - Returns the largest value of the bucket holding the
+ *    pth percentile sample, capped at the largest sample seen
+ */
+static unsigned long long hist_percentile(hist_t *h, double p)
+{
+	unsigned long long rank = (unsigned long long)(p / 100.0 * h->total + 0.5);
+	unsigned long long seen = 0, high;
+	int bucket, msb;
+
+	if (rank == 0)
+		rank = 1;
+	for (bucket = 0; bucket < LAT_BUCKETS; bucket++)
+	{
+		if ((seen += h->counts[bucket]) >= rank)
+			break;
+	}
+	if (bucket < LAT_SUB)
+		high = bucket;
+	else
+	{
+		msb = (bucket >> LAT_SUBBITS) + LAT_SUBBITS - 1;
+		high = ((unsigned long long)(LAT_SUB + (bucket & (LAT_SUB - 1)) + 1)
+				<< (msb - LAT_SUBBITS)) - 1;
+	}
+	return (high < h->max) ? high : h->max;
+}
+
+/*
+ * eval_mm_latency - Replays a trace LATENCY_RUNS times, timing every
+ *    request on its own, and prints p50/p99/p999/max per request type.
+ *    Only the allocator call sits between the two timer reads, and the
+ *    histogram update is a handful of instructions outside them.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum)
+{
+	static char *names[] = {"malloc", "free", "realloc"};
+	static hist_t hists[3];
+	unsigned long long t0, t1, overhead;
+	double ns_per_tick;
+	traceop_t *op;
+	char *p;
+	int i, run, type;
+
+	ns_per_tick = lat_calibrate(&overhead);
+	memset(hists, 0, sizeof(hists));
+
+	for (run = 0; run < LATENCY_RUNS; run++)
+	{
+		mem_reset_brk();
+		if (mm_init_opts(&mm_opts) < 0)
+		app_error("mm_init failed in eval_mm_latency");
+
+		for (i = 0; i < trace->num_ops; i++)
+		{
+			op = &trace->ops[i];
+			switch (op->type)
+			{
+			case ALLOC: /* mm_malloc */
+				t0 = lat_ticks();
+				p = mm_malloc(op->size);
+				t1 = lat_ticks();
+				if (p == NULL)
+				app_error("mm_malloc error in eval_mm_latency");
+				trace->blocks[op->index] = p;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				t0 = lat_ticks();
+				p = mm_realloc(trace->blocks[op->index], op->size);
+				t1 = lat_ticks();
+				if (p == NULL)
+				app_error("mm_realloc error in eval_mm_latency");
+				trace->blocks[op->index] = p;
+				break;
+
+			case FREE: /* mm_free */
+				t0 = lat_ticks();
+				mm_free(trace->blocks[op->index]);
+				t1 = lat_ticks();
+				break;
+
+			default:
+				app_error("Nonexistent request type in eval_mm_latency");
+				return;
+			}
+			t1 -= t0;
+			hist_record(&hists[op->type], (t1 > overhead) ? t1 - overhead : 0);
+		}
+	}
+
+	printf("Latency of trace %d in ns, %d runs:\n", tracenum, LATENCY_RUNS);
+	printf("%8s%9s%9s%9s%9s%9s\n", "request", "count", "p50", "p99", "p999", "max");
+	for (type = ALLOC; type <= REALLOC; type++)
+	{
+		if (hists[type].total == 0)
+			continue;
+		printf("%8s%9llu%9.0f%9.0f%9.0f%9.0f\n",
+			   names[type],
+			   hists[type].total,
+			   hist_percentile(&hists[type], 50.0) * ns_per_tick,
+			   hist_percentile(&hists[type], 99.0) * ns_per_tick,
+			   hist_percentile(&hists[type], 99.9) * ns_per_tick,
+			   hists[type].max * ns_per_tick);
+	}
+}
+
+/*
+ * eval_mm_stats - Replays a trace once and prints the allocator's
+ *    counters at the end of it, and the free blocks at the request where
+ *    the live payload peaked, which is where utilization is measured.
+ */
+static void eval_mm_stats(trace_t *trace, int tracenum)
+{
+	mm_stats_t peak, end;
+	traceop_t *op;
+	char *p;
+	int i, c, peak_op = 0;
+	long total_size = 0, max_total_size = 0;
+
+	/* The request after which the payload peaks depends only on the trace */
+	for (i = 0; i < trace->num_ops; i++)
+	{
+		op = &trace->ops[i];
+		if (op->type == FREE)
+			total_size -= trace->block_sizes[op->index];
+		else
+		{
+			total_size += op->size - ((op->type == REALLOC) ? trace->block_sizes[op->index] : 0);
+			trace->block_sizes[op->index] = op->size;
+		}
+		if (total_size > max_total_size)
+		{
+			max_total_size = total_size;
+			peak_op = i;
+		}
+	}
+
+	mem_reset_brk();
+	if (mm_init_opts(&mm_opts) < 0)
+	app_error("mm_init failed in eval_mm_stats");
+
+	for (i = 0; i < trace->num_ops; i++)
+	{
+		op = &trace->ops[i];
+		switch (op->type)
+		{
+		case ALLOC: /* mm_malloc */
+			if ((p = mm_malloc(op->size)) == NULL)
+			app_error("mm_malloc error in eval_mm_stats");
+			trace->blocks[op->index] = p;
+			break;
+
+		case REALLOC: /* mm_realloc */
+			if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+			app_error("mm_realloc error in eval_mm_stats");
+			trace->blocks[op->index] = p;
+			break;
+
+		case FREE: /* mm_free */
+			mm_free(trace->blocks[op->index]);
+			break;
+
+		default:
+			app_error("Nonexistent request type in eval_mm_stats");
+		}
+		if ((i == peak_op) && (mm_stats(&peak) < 0))
+		{
+			printf("Statistics need an allocator built with \"make STATS=1\"\n");
+			return;
+		}
+	}
+	mm_stats(&end);
+
+	printf("Statistics of trace %d:\n", tracenum);
+	printf("  extend_heap %lu, realloc tag skips %lu\n", end.extends, end.tag_skips);
+	printf("  fit searches %lu, nodes walked avg %.1f max %lu\n", end.fit_searches,
+		   end.fit_searches ? (double)end.fit_walked / end.fit_searches : 0.0, end.fit_walked_max);
+	printf("  list inserts %lu, nodes walked avg %.1f max %lu\n", end.insert_searches,
+		   end.insert_searches ? (double)end.insert_walked / end.insert_searches : 0.0,
+		   end.insert_walked_max);
+
+	printf("%10s%10s%10s%10s%10s\n", "class", "allocs", "frees", "splits", "coalesces");
+	for (c = 0; c < MM_STATS_CLASSES; c++)
+	{
+		if (end.classes[c].allocs + end.classes[c].frees +
+			end.classes[c].splits + end.classes[c].coalesces == 0)
+			continue;
+		printf("%9lu%s%10lu%10lu%10lu%10lu\n", (unsigned long)end.classes[c].min_size,
+			   (c + 1 < MM_STATS_CLASSES && end.classes[c + 1].min_size != 0) ? " " : "+",
+			   end.classes[c].allocs, end.classes[c].frees,
+			   end.classes[c].splits, end.classes[c].coalesces);
+	}
+
+	printf("  at peak payload (request %d): %lu free blocks, %lu bytes, largest %lu\n",
+		   peak_op, peak.free_blocks, (unsigned long)peak.free_bytes,
+		   (unsigned long)peak.largest_free);
+	printf("  external fragmentation %.1f%%, %lu blocks (%lu bytes) in quick lists\n",
+		   peak.free_bytes ? 100.0 * (1.0 - (double)peak.largest_free / peak.free_bytes) : 0.0,
+		   peak.quick_blocks, (unsigned long)peak.quick_bytes);
+	for (c = 0; c < MM_STATS_HISTBINS; c++)
+		if (peak.free_hist[c] != 0)
+			printf("  free blocks of [2^%d, 2^%d) bytes: %lu\n", c, c + 1, peak.free_hist[c]);
+	printf("\n");
+}
+
+/*
+ * blockmap_slot - Returns the slot that holds id, or the empty slot
+ *     where it would go
+ */
+static unsigned int blockmap_slot(blockmap_t *map, unsigned int id)
+{
+	unsigned int i = (id * 2654435761U) & map->mask;
+
+	while (map->ids[i] && (map->ids[i] != id + 1))
+		i = (i + 1) & map->mask;
+	return i;
+}
+
+/*
+ * blockmap_init - Allocates room for 2^bits slots
+ */
+static void blockmap_init(blockmap_t *map, int bits)
+{
+	map->mask = (1U << bits) - 1;
+	map->used = 0;
+	if (((map->ids = calloc(map->mask + 1, sizeof(unsigned int))) == NULL) ||
+		((map->blocks = malloc((map->mask + 1) * sizeof(char *))) == NULL) ||
+		((map->sizes = malloc((map->mask + 1) * sizeof(int))) == NULL))
+	unix_error("malloc failed in blockmap_init");
+}
+
+/*
+ * blockmap_free - Releases the storage of a block map
+ */
+static void blockmap_free(blockmap_t *map)
+{
+	free(map->ids);
+	free(map->blocks);
+	free(map->sizes);
+}
+
+/*
+ * blockmap_put - Records the payload of block id, doubling the table
+ *     once it is half full
+ */
+static void blockmap_put(blockmap_t *map, unsigned int id, char *p, int size)
+{
+	blockmap_t old;
+	unsigned int i;
+
+	if (2 * (map->used + 1) > map->mask + 1)
+	{
+		old = *map;
+		blockmap_init(map, __builtin_ctz(old.mask + 1) + 1);
+		for (i = 0; i <= old.mask; i++)
+		{
+			if (old.ids[i])
+				blockmap_put(map, old.ids[i] - 1, old.blocks[i], old.sizes[i]);
+		}
+		blockmap_free(&old);
+	}
+
+	i = blockmap_slot(map, id);
+	if (!map->ids[i])
+		map->used++;
+	map->ids[i] = id + 1;
+	map->blocks[i] = p;
+	map->sizes[i] = size;
+}
+
+/*
+ * blockmap_remove - Forgets block id, shifting later entries of its
+ *     probe run back so that no tombstones are needed
+ */
+static void blockmap_remove(blockmap_t *map, unsigned int id)
+{
+	unsigned int i = blockmap_slot(map, id);
+	unsigned int j, home;
+
+	if (!map->ids[i])
+		return;
+	map->used--;
+	for (j = (i + 1) & map->mask; map->ids[j]; j = (j + 1) & map->mask)
+	{
+		home = ((map->ids[j] - 1) * 2654435761U) & map->mask;
+		/* Move j into the hole at i unless its home lies in (i, j] */
+		if (((j - home) & map->mask) >= ((j - i) & map->mask))
+		{
+			map->ids[i] = map->ids[j];
+			map->blocks[i] = map->blocks[j];
+			map->sizes[i] = map->sizes[j];
+			i = j;
+		}
+	}
+	map->ids[i] = 0;
+}
+
+/*
+ * stream_fill - Reads up to STREAM_CHUNK requests into buf and returns
+ *     how many it read, 0 at the end of the trace
+ */
+static int stream_fill(stream_t *st, traceop_t *buf)
+{
+	char type[MAXLINE];
+	unsigned index, size;
+	int n = 0;
+
+	if (st->binary)
+		return fread(buf, sizeof(traceop_t), STREAM_CHUNK, st->file);
+
+	while ((n < STREAM_CHUNK) && (fscanf(st->file, "%s", type) == 1))
+	{
+		switch (type[0])
+		{
+		case 'a':
+		case 'r':
+			if (fscanf(st->file, "%u %u", &index, &size) != 2)
+			app_error("Truncated request in streamed trace");
+			buf[n].type = (type[0] == 'a') ? ALLOC : REALLOC;
+			buf[n].index = index;
+			buf[n].size = size;
+			break;
+		case 'f':
+			if (fscanf(st->file, "%u", &index) != 1)
+			app_error("Truncated request in streamed trace");
+			buf[n].type = FREE;
+			buf[n].index = index;
+			break;
+		default:
+			printf("Bogus type character (%c) in streamed trace\n", type[0]);
+			exit(1);
+		}
+		n++;
+	}
+	return n;
+}
+
+/*
+ * stream_reader - Fills the two buffers in turn, each as soon as the
+ *     replay has finished with it, and stops after an empty one or
+ *     when the replay asks it to
+ */
+static void *stream_reader(void *ptr)
+{
+	stream_t *st = (stream_t *)ptr;
+	int b, n, stop;
+
+	for (b = 0;; b ^= 1)
+	{
+		pthread_mutex_lock(&st->lock);
+		while (st->full[b] && !st->stop)
+			pthread_cond_wait(&st->cond, &st->lock);
+		stop = st->stop;
+		pthread_mutex_unlock(&st->lock);
+		if (stop)
+			return NULL;
+
+		n = stream_fill(st, st->bufs[b]);
+
+		pthread_mutex_lock(&st->lock);
+		st->counts[b] = n;
+		st->full[b] = 1;
+		pthread_cond_signal(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+		if (n == 0)
+			return NULL;
+	}
+}
+
+/*
+ * eval_mm_stream - Replays a trace through the mm package while another
+ *     thread reads it, so only two buffers of requests and the live
+ *     blocks are ever in memory. Payloads are checked for alignment
+ *     and heap bounds only; the time the replay waited on the reader
+ *     is reported separately.
+ */
+static int eval_mm_stream(char *tracedir, char *filename, int tracenum)
+{
+	stream_t st;
+	blockmap_t map;
+	pthread_t reader;
+	bintrace_t bin;
+	char path[MAXLINE];
+	traceop_t *op;
+	unsigned int slot;
+	long long opnum = 0;
+	double start, wait, stalled = 0;
+	char *p;
+	int b, i, n, valid = 1;
+	int hdr[4];
+
+	strcpy(path, tracedir);
+	strcat(path, filename);
+	if ((st.file = fopen(path, "r")) == NULL)
+	{
+	sprintf(msg, "Could not open %s in eval_mm_stream", path);
+	unix_error(msg);
+	}
+	st.binary = (fread(&bin, sizeof(bin), 1, st.file) == 1) &&
+		!memcmp(bin.magic, BINTRACE_MAGIC, sizeof(bin.magic));
+	if (!st.binary)
+	{
+	rewind(st.file);
+	if (fscanf(st.file, "%d %d %d %d", &hdr[0], &hdr[1], &hdr[2], &hdr[3]) != 4)
+		app_error("Bad header in streamed trace");
+	}
+
+	for (b = 0; b < 2; b++)
+	{
+		if ((st.bufs[b] = malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+		unix_error("malloc failed in eval_mm_stream");
+		st.full[b] = 0;
+	}
+	st.stop = 0;
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+	blockmap_init(&map, 10);
+
+	mem_reset_brk();
+	if (mm_init_opts(&mm_opts) < 0)
+	app_error("mm_init failed in eval_mm_stream");
+	if (pthread_create(&reader, NULL, stream_reader, &st) != 0)
+	unix_error("pthread_create in eval_mm_stream failed");
+
+	start = replay_clock();
+	for (b = 0; valid; b ^= 1)
+	{
+		wait = replay_clock();
+		pthread_mutex_lock(&st.lock);
+		while (!st.full[b])
+			pthread_cond_wait(&st.cond, &st.lock);
+		n = st.counts[b];
+		pthread_mutex_unlock(&st.lock);
+		stalled += replay_clock() - wait;
+		if (n == 0)
+			break;
+
+		for (i = 0; i < n; i++, opnum++)
+		{
+			op = &st.bufs[b][i];
+			slot = blockmap_slot(&map, op->index);
+			if ((op->type != ALLOC) && !map.ids[slot])
+			{
+				malloc_error(tracenum, opnum, "request names a block that is not allocated");
+				valid = 0;
+				break;
+			}
+			if (op->type == FREE)
+			{
+				mm_free(map.blocks[slot]);
+				blockmap_remove(&map, op->index);
+				continue;
+			}
+
+			if (op->type == ALLOC)
+				p = mm_malloc(op->size);
+			else
+				p = mm_realloc(map.blocks[slot], op->size);
+			if ((p == NULL) || !IS_ALIGNED(p) ||
+				(((p < (char *)mem_heap_lo()) || (p + op->size - 1 > (char *)mem_heap_hi())) &&
+				 !mem_is_mapped(p, p + op->size - 1)))
+			{
+				malloc_error(tracenum, opnum, "mm_malloc or mm_realloc returned a bad payload");
+				valid = 0;
+				break;
+			}
+			blockmap_put(&map, op->index, p, op->size);
+		}
+
+		pthread_mutex_lock(&st.lock);
+		st.full[b] = 0;
+		pthread_cond_signal(&st.cond);
+		pthread_mutex_unlock(&st.lock);
+	}
+	start = replay_clock() - start;
+
+	/* Stop a reader that is still going */
+	pthread_mutex_lock(&st.lock);
+	st.stop = 1;
+	pthread_cond_signal(&st.cond);
+	pthread_mutex_unlock(&st.lock);
+	pthread_join(reader, NULL);
+
+	if (valid)
+		printf("%2d%10s%12lld%10.6f%8.0f%10.6f\n",
+			   tracenum, "yes", opnum, start, (opnum / 1e3) / start, stalled);
+	else
+		printf("%2d%10s%12s%10s%8s%10s\n", tracenum, "no", "-", "-", "-", "-");
+
+	fclose(st.file);
+	pthread_mutex_destroy(&st.lock);
+	pthread_cond_destroy(&st.cond);
+	free(st.bufs[0]);
+	free(st.bufs[1]);
+	blockmap_free(&map);
+	return valid;
+}
+
+/*
+ * time_trace - Times f on one trace into stats->secs, with the spread
+ *    of the timed runs relative to their mean in stats->cv and stats->ci
+ */
+static void time_trace(fsecs_test_funct f, speed_t *params, stats_t *stats)
+{
+	double mean, stddev;
+	int n;
+
+	stats->secs = fsecs(f, params);
+	stats->cv = stats->ci = 0;
+	n = fsecs_spread(&mean, &stddev);
+	if ((n > 1) && (mean > 0))
+	{
+		stats->cv = stddev / mean;
+		stats->ci = t95[(n - 2 < T95_DFS) ? n - 2 : T95_DFS - 1] * stats->cv / sqrt(n);
+	}
+}
+
+/*
+ * total_spread - Returns in *cv and *ci the relative spread of the
+ *    total time of the valid traces, as the variances of independent
+ *    timings add up
+ */
+static void total_spread(int n, stats_t *stats, double *cv, double *ci)
+{
+	double secs = 0, var = 0, civar = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (!stats[i].valid)
+			continue;
+		secs += stats[i].secs;
+		var += (stats[i].cv * stats[i].secs) * (stats[i].cv * stats[i].secs);
+		civar += (stats[i].ci * stats[i].secs) * (stats[i].ci * stats[i].secs);
+	}
+	*cv = (secs > 0) ? sqrt(var) / secs : 0;
+	*ci = (secs > 0) ? sqrt(civar) / secs : 0;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc (or the -A baseline) can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+	int i, newsize;
+	char *p, *newp, *oldp;
+
+	for (i = 0; i < trace->num_ops; i++)
+	{
+	switch (trace->ops[i].type)
+	{
+
+	case ALLOC: /* malloc */
+		if ((p = base_malloc(trace->ops[i].size)) == NULL)
+		{
+		malloc_error(tracenum, i, "baseline malloc failed");
+		unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index] = p;
+		break;
+
+	case REALLOC: /* realloc */
+		newsize = trace->ops[i].size;
+		oldp = trace->blocks[trace->ops[i].index];
+		if ((newp = base_realloc(oldp, newsize)) == NULL)
+		{
+		malloc_error(tracenum, i, "baseline realloc failed");
+		unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index] = newp;
+		break;
+
+	case FREE: /* free */
+		base_free(trace->blocks[trace->ops[i].index]);
+		break;
+
+	default:
+		app_error("invalid operation type  in eval_libc_valid");
+	}
+	}
+
+	return 1;
+}
+
+/*
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package (or the -A
+ *    baseline) on the set of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+	int i;
+	int index, size, newsize;
+	char *p, *newp, *oldp, *block;
+	unsigned char seen = 0;
+	trace_t *trace = ((speed_t *)ptr)->trace;
+
+	for (i = 0; i < trace->num_ops; i++)
+	{
+	switch (trace->ops[i].type)
+	{
+	case ALLOC: /* malloc */
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		if ((p = base_malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[index] = p;
+		if (touch)
+		{
+			trace->block_sizes[index] = size;
+			touch_payload(p, size, 1);
+		}
+		break;
+
+	case REALLOC: /* realloc */
+		index = trace->ops[i].index;
 		newsize = trace->ops[i].size;
 		oldp = trace->blocks[index];
-		if ((newp = realloc(oldp, newsize)) == NULL)
+		if ((newp = base_realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
 
 		trace->blocks[index] = newp;
+		if (touch)
+		{
+			trace->block_sizes[index] = newsize;
+			touch_payload(newp, newsize, 1);
+		}
 		break;
 
 	case FREE: /* free */
 		index = trace->ops[i].index;
 		block = trace->blocks[index];
-		free(block);
+		if (touch)
+			seen += touch_payload(block, trace->block_sizes[index], 0);
+		base_free(block);
 		break;
 	}
 	}
+	touch_sink = seen;
+}
+
+/*
+ * load_baseline - Makes -l replay the traces on the malloc, free and
+ *    realloc of a shared library instead of libc's
+ */
+static void load_baseline(char *path)
+{
+	void *lib;
+
+	if ((lib = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	{
+		sprintf(msg, "Could not load %s: %s", path, dlerror());
+		app_error(msg);
+	}
+	base_malloc = (void *(*)(size_t))dlsym(lib, "malloc");
+	base_free = (void (*)(void *))dlsym(lib, "free");
+	base_realloc = (void *(*)(void *, size_t))dlsym(lib, "realloc");
+	if ((base_malloc == NULL) || (base_free == NULL) || (base_realloc == NULL))
+	{
+		sprintf(msg, "%s does not export malloc, free and realloc", path);
+		app_error(msg);
+	}
+	base_name = (strrchr(path, '/') != NULL) ? strrchr(path, '/') + 1 : path;
+}
+
+/*****************************************************************
+ * Routines for scoring a configuration of the mm package, and for
+ * sweeping its runtime options to find the configurations that
+ * trade utilization against throughput best
+ ****************************************************************/
+
+/*
+ * eval_mm_traces - Checks, measures the utilization of and times the
+ *    mm package on every trace, with the options in mm_opts
+ */
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats)
+{
+	range_t *ranges = NULL;
+	speed_t speed_params;
+	trace_t *trace;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (verbose > 1)
+		printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (stats[i].valid)
+	{
+		if (verbose > 1)
+		printf("efficiency, ");
+		stats[i].util = eval_mm_util(trace, i, &ranges);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		if (verbose > 1)
+		printf("and performance.\n");
+		time_trace(eval_mm_speed, &speed_params, &stats[i]);
+	}
+	free_trace(trace);
+	}
+	clear_ranges(&ranges);
+}
+
+/*
+ * perf_index - Weighs the average utilization and the throughput in
+ *    ops/sec into the performance index, with the util and throughput
+ *    parts returned in p1 and p2
+ */
+static double perf_index(double util, double throughput, double *p1, double *p2)
+{
+	*p1 = UTIL_WEIGHT * util;
+	if (throughput > AVG_LIBC_THRUPUT)
+	{
+		*p2 = (double)(1.0 - UTIL_WEIGHT);
+	}
+	else
+	{
+		*p2 = ((double)(1.0 - UTIL_WEIGHT)) *
+			  (throughput / AVG_LIBC_THRUPUT);
+	}
+	return (*p1 + *p2) * 100.0;
+}
+
+/*
+ * set_mm_opt - Sets the mm option called name from its text value.
+ *    Returns -1 if there is no such option or the value is malformed.
+ */
+static int set_mm_opt(mm_opts_t *opts, char *name, char *value)
+{
+	unsigned long n;
+	char *end;
+	int i;
+
+	if (strcmp(name, "fit") == 0)
+	{
+		for (i = MM_FIT_BEST; i <= MM_FIT_GOOD; i++)
+			if (strcmp(value, fit_names[i]) == 0)
+			{
+				opts->fit = i;
+				return 0;
+			}
+		return -1;
+	}
+
+	n = strtoul(value, &end, 0);
+	if ((*value == '\0') || (*end != '\0'))
+		return -1;
+	if (strcmp(name, "candidates") == 0)
+	{
+		if (n == 0)
+			return -1;
+		opts->fit_candidates = n;
+	}
+	else if (strcmp(name, "back") == 0)
+		opts->back_place_min = n;
+	else if (strcmp(name, "split") == 0)
+		opts->split_min = n;
+	else if (strcmp(name, "chunk") == 0)
+		opts->chunk_size = n;
+	else if (strcmp(name, "initchunk") == 0)
+		opts->init_chunk_size = n;
+	else if (strcmp(name, "reallocbuf") == 0)
+		opts->realloc_buffer = n;
+	else if (strcmp(name, "addrsmall") == 0)
+		opts->addr_order_small = (n != 0);
+	else if (strcmp(name, "adjacent") == 0)
+		opts->prefer_adjacent = (n != 0);
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * parse_fit - Sets the placement policy of a -P spec: best, first, next,
+ *    or good with an optional :<k>, a bound of at least 1 on the nodes
+ *    visited per list. Returns -1 if the spec is anything else.
+ */
+static int parse_fit(mm_opts_t *opts, char *spec)
+{
+	char name[MAXLINE], *bound;
+	mm_opts_t o = *opts;
+
+	if (strlen(spec) >= MAXLINE)
+		return -1;
+	strcpy(name, spec);
+	if ((bound = strchr(name, ':')) != NULL)
+		*bound++ = '\0';
+	if ((set_mm_opt(&o, "fit", name) < 0) ||
+		((bound != NULL) && ((o.fit != MM_FIT_GOOD) || (set_mm_opt(&o, "candidates", bound) < 0))))
+		return -1;
+	*opts = o;
+	return 0;
+}
+
+/*
+ * parse_mm_opts - Sets the options of a name=value[,name=value...] spec,
+ *    marking in fixed each one a sweep must leave alone
+ */
+static int parse_mm_opts(mm_opts_t *opts, char *spec, unsigned int *fixed)
+{
+	char *copy, *opt, *value, *save;
+	int p, ret = 0;
+
+	if ((copy = strdup(spec)) == NULL)
+		unix_error("strdup failed in parse_mm_opts");
+	for (opt = strtok_r(copy, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save))
+	{
+		if ((value = strchr(opt, '=')) == NULL)
+		{
+			ret = -1;
+			break;
+		}
+		*value++ = '\0';
+		if ((ret = set_mm_opt(opts, opt, value)) < 0)
+			break;
+		for (p = 0; p < SWEEP_PARAMS; p++)
+			if (strcmp(opt, sweep_params[p].name) == 0)
+				*fixed |= 1U << p;
+	}
+	free(copy);
+	return ret;
+}
+
+/*
+ * format_mm_opts - Writes opts to buf in the -O syntax
+ */
+static void format_mm_opts(mm_opts_t *opts, char *buf)
+{
+	sprintf(buf, "fit=%s,candidates=%u,back=%lu,split=%lu,chunk=%lu,initchunk=%lu,reallocbuf=%lu,"
+			"addrsmall=%d,adjacent=%d",
+			fit_names[opts->fit], opts->fit_candidates,
+			(unsigned long)opts->back_place_min, (unsigned long)opts->split_min,
+			(unsigned long)opts->chunk_size, (unsigned long)opts->init_chunk_size,
+			(unsigned long)opts->realloc_buffer, opts->addr_order_small, opts->prefer_adjacent);
+}
+
+/*
+ * eval_mm_sweep - Scores configurations of the mm options over the
+ *    traces: every combination of the sweep_params values ("grid"), or
+ *    n random ones ("random:<n>"), leaving the options set with -O as
+ *    they are. Prints the Pareto front of utilization against
+ *    throughput and writes every result to outfile, if given.
+ */
+static void eval_mm_sweep(char **tracefiles, int n, char *spec,
+			  unsigned int fixed, char *outfile)
+{
+	mm_opts_t base = mm_opts;
+	sweep_result_t *results, *r;
+	stats_t *stats;
+	char buf[MAXLINE];
+	double secs, ops, util, p1, p2;
+	int count, random_search, nvalues, choice, idx, i, j, p;
+
+	if (strcmp(spec, "grid") == 0)
+	{
+		random_search = 0;
+		count = 1;
+		for (p = 0; p < SWEEP_PARAMS; p++)
+		{
+			for (nvalues = 0; sweep_params[p].values[nvalues] != NULL; nvalues++)
+				;
+			if (!(fixed & (1U << p)))
+				count *= nvalues;
+		}
+	}
+	else if ((strncmp(spec, "random:", 7) == 0) && ((count = atoi(spec + 7)) > 0))
+	{
+		random_search = 1;
+		srandom(1);
+	}
+	else
+	{
+		usage();
+		exit(1);
+	}
+
+	if (((results = calloc(count, sizeof(sweep_result_t))) == NULL) ||
+		((stats = calloc(n, sizeof(stats_t))) == NULL))
+		unix_error("calloc failed in eval_mm_sweep");
+
+	for (i = 0; i < count; i++)
+	{
+		/* Decode configuration i, or draw one at random */
+		r = &results[i];
+		r->opts = base;
+		idx = i;
+		for (p = 0; p < SWEEP_PARAMS; p++)
+		{
+			if (fixed & (1U << p))
+				continue;
+			for (nvalues = 0; sweep_params[p].values[nvalues] != NULL; nvalues++)
+				;
+			choice = random_search ? (int)(random() % nvalues) : idx % nvalues;
+			idx /= nvalues;
+			set_mm_opt(&r->opts, sweep_params[p].name, sweep_params[p].values[choice]);
+		}
+
+		mm_opts = r->opts;
+		errors = 0;
+		eval_mm_traces(tracefiles, n, stats);
+
+		secs = ops = util = 0;
+		r->valid = (errors == 0);
+		for (j = 0; j < n; j++)
+		{
+			secs += stats[j].secs;
+			ops += stats[j].ops;
+			util += stats[j].util;
+			r->valid &= stats[j].valid;
+		}
+		if (r->valid)
+		{
+			r->util = util / n;
+			r->kops = ops / secs / 1e3;
+			r->perfindex = perf_index(r->util, ops / secs, &p1, &p2);
+		}
+
+		format_mm_opts(&r->opts, buf);
+		if (r->valid)
+			printf("%4d/%d  util %5.1f%%  %8.0f Kops  perf %5.1f  %s\n",
+				   i + 1, count, r->util * 100.0, r->kops, r->perfindex, buf);
+		else
+			printf("%4d/%d  invalid  %s\n", i + 1, count, buf);
+		fflush(stdout);
+	}
+	mm_opts = base;
+
+	/* A configuration is on the front if none is at least as good at both and better at one */
+	for (i = 0; i < count; i++)
+	{
+		results[i].pareto = results[i].valid;
+		for (j = 0; (j < count) && results[i].pareto; j++)
+		{
+			if (results[j].valid &&
+				(results[j].util >= results[i].util) && (results[j].kops >= results[i].kops) &&
+				((results[j].util > results[i].util) || (results[j].kops > results[i].kops)))
+				results[i].pareto = 0;
+		}
+	}
+
+	printf("\nPareto front of utilization against throughput:\n");
+	for (i = 0; i < count; i++)
+	{
+		if (!results[i].pareto)
+			continue;
+		format_mm_opts(&results[i].opts, buf);
+		printf("  util %5.1f%%  %8.0f Kops  perf %5.1f  %s\n",
+			   results[i].util * 100.0, results[i].kops, results[i].perfindex, buf);
+	}
+
+	if (outfile != NULL)
+		write_sweep(outfile, results, count);
+	free(results);
+	free(stats);
+}
+
+/*
+ * write_sweep - Writes the sweep results to outfile, as JSON if its name
+ *    ends in ".json" and as CSV otherwise
+ */
+static void write_sweep(char *outfile, sweep_result_t *results, int count)
+{
+	size_t len = strlen(outfile);
+	int json = (len >= 5) && (strcmp(outfile + len - 5, ".json") == 0);
+	sweep_result_t *r;
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(outfile, "w")) == NULL)
+	{
+		sprintf(msg, "Could not open %s in write_sweep", outfile);
+		unix_error(msg);
+	}
+
+	if (json)
+		fprintf(fp, "[\n");
+	else
+		fprintf(fp, "fit,candidates,back,split,chunk,initchunk,reallocbuf,addrsmall,adjacent,"
+				"valid,util,kops,perfindex,pareto\n");
+	for (i = 0; i < count; i++)
+	{
+		r = &results[i];
+		if (json)
+			fprintf(fp, "  {\"fit\": \"%s\", \"candidates\": %u, \"back\": %lu, "
+					"\"split\": %lu, \"chunk\": %lu, \"initchunk\": %lu, \"reallocbuf\": %lu, "
+					"\"addrsmall\": %d, \"adjacent\": %d, "
+					"\"valid\": %s, \"util\": %.4f, \"kops\": %.1f, \"perfindex\": %.2f, "
+					"\"pareto\": %s}%s\n",
+					fit_names[r->opts.fit], r->opts.fit_candidates,
+					(unsigned long)r->opts.back_place_min, (unsigned long)r->opts.split_min,
+					(unsigned long)r->opts.chunk_size, (unsigned long)r->opts.init_chunk_size,
+					(unsigned long)r->opts.realloc_buffer,
+					r->opts.addr_order_small, r->opts.prefer_adjacent,
+					r->valid ? "true" : "false", r->util, r->kops, r->perfindex,
+					r->pareto ? "true" : "false", (i + 1 < count) ? "," : "");
+		else
+			fprintf(fp, "%s,%u,%lu,%lu,%lu,%lu,%lu,%d,%d,%d,%.4f,%.1f,%.2f,%d\n",
+					fit_names[r->opts.fit], r->opts.fit_candidates,
+					(unsigned long)r->opts.back_place_min, (unsigned long)r->opts.split_min,
+					(unsigned long)r->opts.chunk_size, (unsigned long)r->opts.init_chunk_size,
+					(unsigned long)r->opts.realloc_buffer,
+					r->opts.addr_order_small, r->opts.prefer_adjacent,
+					r->valid, r->util, r->kops, r->perfindex, r->pareto);
+	}
+	if (json)
+		fprintf(fp, "]\n");
+	fclose(fp);
+}
+
+/*
+ * write_trace_results - Writes one allocator's per-trace results and
+ *    total to fp, as JSON or as CSV rows
+ */
+static void write_trace_results(FILE *fp, int json, char *name, char **tracefiles,
+				int n, stats_t *stats, double perfindex)
+{
+	double secs = 0, ops = 0, util = 0, cv, ci;
+	int i, valid = 1;
+
+	if (json)
+		fprintf(fp, "    {\"allocator\": \"%s\", \"traces\": [\n", name);
+	for (i = 0; i < n; i++)
+	{
+		if (json)
+			fprintf(fp, "      {\"trace\": \"%s\", \"valid\": %s, \"ops\": %.0f, "
+					"\"secs\": %.6f, \"util\": %.4f, \"kops\": %.1f, \"cv\": %.4f, "
+					"\"ci\": %.4f}%s\n",
+					tracefiles[i], stats[i].valid ? "true" : "false", stats[i].ops,
+					stats[i].secs, stats[i].util,
+					stats[i].valid ? stats[i].ops / 1e3 / stats[i].secs : 0.0,
+					stats[i].cv, stats[i].ci, (i + 1 < n) ? "," : "");
+		else
+			fprintf(fp, "%s,%s,%d,%.0f,%.6f,%.4f,%.1f,,%.4f,%.4f\n", name, tracefiles[i],
+					stats[i].valid, stats[i].ops, stats[i].secs, stats[i].util,
+					stats[i].valid ? stats[i].ops / 1e3 / stats[i].secs : 0.0,
+					stats[i].cv, stats[i].ci);
+		secs += stats[i].secs;
+		ops += stats[i].ops;
+		util += stats[i].util;
+		valid &= stats[i].valid;
+	}
+
+	total_spread(n, stats, &cv, &ci);
+	if (json)
+		fprintf(fp, "    ], \"valid\": %s, \"ops\": %.0f, \"secs\": %.6f, \"util\": %.4f, "
+				"\"kops\": %.1f, \"cv\": %.4f, \"ci\": %.4f, \"perfindex\": %.2f}",
+				valid ? "true" : "false", ops, secs, util / n,
+				valid ? ops / 1e3 / secs : 0.0, cv, ci, perfindex);
+	else
+		fprintf(fp, "%s,total,%d,%.0f,%.6f,%.4f,%.1f,%.2f,%.4f,%.4f\n", name, valid, ops,
+				secs, util / n, valid ? ops / 1e3 / secs : 0.0, perfindex, cv, ci);
+}
+
+/*
+ * write_results - Writes the results of the mm package, and of the
+ *    baseline allocator if it ran, with the configuration of the run to
+ *    outfile: as JSON if its name ends in ".json" and as CSV otherwise,
+ *    where the configuration goes in leading comment lines
+ */
+static void write_results(char *outfile, char **tracefiles, int n,
+			  stats_t *mm_results, stats_t *base_results, double perfindex)
+{
+	size_t len = strlen(outfile);
+	int json = (len >= 5) && (strcmp(outfile + len - 5, ".json") == 0);
+	char opts[MAXLINE];
+	FILE *fp;
+
+	if ((fp = fopen(outfile, "w")) == NULL)
+	{
+		sprintf(msg, "Could not open %s in write_results", outfile);
+		unix_error(msg);
+	}
+	format_mm_opts(&mm_opts, opts);
+
+	if (json)
+	{
+		fprintf(fp, "{\n  \"config\": {\"tracedir\": \"%s\", \"opts\": \"%s\", "
+				"\"baseline\": %s%s%s, \"timer\": \"%s\", \"cache\": \"%s\", \"touch\": %s, "
+				"\"util_weight\": %.2f, \"libc_thruput\": %.0f, "
+				"\"time\": %ld},\n  \"results\": [\n",
+				tracedir, opts, base_results ? "\"" : "", base_results ? base_name : "null",
+				base_results ? "\"" : "", timer_names[timer], cache_names[cache_mode],
+				touch ? "true" : "false", UTIL_WEIGHT, AVG_LIBC_THRUPUT, (long)time(NULL));
+		write_trace_results(fp, 1, "mm", tracefiles, n, mm_results, perfindex);
+		if (base_results != NULL)
+		{
+			fprintf(fp, ",\n");
+			write_trace_results(fp, 1, base_name, tracefiles, n, base_results, 0.0);
+		}
+		fprintf(fp, "\n  ]\n}\n");
+	}
+	else
+	{
+		fprintf(fp, "# tracedir=%s\n# opts=%s\n# timer=%s cache=%s touch=%d\n"
+				"# util_weight=%.2f libc_thruput=%.0f time=%ld\n",
+				tracedir, opts, timer_names[timer], cache_names[cache_mode], touch,
+				UTIL_WEIGHT, AVG_LIBC_THRUPUT, (long)time(NULL));
+		fprintf(fp, "allocator,trace,valid,ops,secs,util,kops,perfindex,cv,ci\n");
+		write_trace_results(fp, 0, "mm", tracefiles, n, mm_results, perfindex);
+		if (base_results != NULL)
+			write_trace_results(fp, 0, base_name, tracefiles, n, base_results, 0.0);
+	}
+	fclose(fp);
 }
 
 /*************************************
@@ -935,7 +2785,8 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * printresults - prints a performance summary for some malloc package,
+ *    with the 95% confidence half-width of each time
  */
 static void printresults(int n, stats_t *stats)
 {
@@ -943,21 +2794,23 @@ static void printresults(int n, stats_t *stats)
 	double secs = 0;
 	double ops = 0;
 	double util = 0;
+	double cv, ci;
 
 	/* Print the individual results for each trace */
-	printf("%5s%7s %5s%8s%10s%6s\n",
-		   "trace", " valid", "util", "ops", "secs", "Kops");
+	printf("%5s%7s %5s%8s%10s%6s%7s\n",
+		   "trace", " valid", "util", "ops", "secs", "Kops", "+/-");
 	for (i = 0; i < n; i++)
 	{
 	if (stats[i].valid)
 	{
-		printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n",
+		printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f%6.1f%%\n",
 			   i,
 			   "yes",
 			   stats[i].util * 100.0,
 			   stats[i].ops,
 			   stats[i].secs,
-			   (stats[i].ops / 1e3) / stats[i].secs);
+			   (stats[i].ops / 1e3) / stats[i].secs,
+			   stats[i].ci * 100.0);
 		secs += stats[i].secs;
 		ops += stats[i].ops;
 		util += stats[i].util;
@@ -977,12 +2830,14 @@ static void printresults(int n, stats_t *stats)
 	/* Print the aggregate results for the set of traces */
 	if (errors == 0)
 	{
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n",
+	total_spread(n, stats, &cv, &ci);
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f%6.1f%%\n",
 		   "Total       ",
 		   (util / n) * 100.0,
 		   ops,
 		   secs,
-		   (ops / 1e3) / secs);
+		   (ops / 1e3) / secs,
+		   ci * 100.0);
 	}
 	else
 	{
@@ -1027,14 +2882,42 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+	fprintf(stderr, "Usage: mdriver [-hvValpLSsU] [-f <file>] [-t <dir>] [-j <n>] [-B <file>] [-C <mode>]\n");
+	fprintf(stderr, "               [-P <fit>[:<k>]] [-b <bytes>]\n");
+	fprintf(stderr, "               [-O <opts>] [-X <how>] [-o <file>] [-A <lib>]\n");
+	fprintf(stderr, "               [-T <timer>[:<cpu>]] [-W <cache>[:<bytes>]]\n");
 	fprintf(stderr, "Options\n");
 	fprintf(stderr, "\t-a         Don't check the team structure.\n");
-	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+	fprintf(stderr, "\t-A <lib>   Run the malloc of shared library <lib> as well, instead of libc's.\n");
+	fprintf(stderr, "\t-b <bytes> Place blocks of at least <bytes> at the end of their free block.\n");
+	fprintf(stderr, "\t-B <file>  Convert the -f trace to binary trace <file> and exit.\n");
+	fprintf(stderr, "\t-C <mode>  Check the heap after each request: full, incremental,\n");
+	fprintf(stderr, "\t           or a full check every <n> requests.\n");
+	fprintf(stderr, "\t-f <file>  Use <file> as the trace file (text or binary).\n");
 	fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
 	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-j <n>     Also replay each trace on <n> threads at once.\n");
 	fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+	fprintf(stderr, "\t-L         Print latency percentiles of each request type.\n");
+	fprintf(stderr, "\t-o <file>  Write the results, or those of -X, to <file>: as JSON if\n");
+	fprintf(stderr, "\t           it ends in .json and as CSV otherwise.\n");
+	fprintf(stderr, "\t-O <opts>  Set mm options, as name=value[,...]: fit, candidates, back,\n");
+	fprintf(stderr, "\t           split, chunk, initchunk, reallocbuf, addrsmall, adjacent.\n");
+	fprintf(stderr, "\t-p         With -j, split each trace among the threads.\n");
+	fprintf(stderr, "\t-P <fit>   Placement policy: best, first, next or good[:<k>], which\n");
+	fprintf(stderr, "\t           visits at most <k> nodes per free list.\n");
+	fprintf(stderr, "\t-s         Print the allocator's statistics (make STATS=1).\n");
+	fprintf(stderr, "\t-S         Only replay the traces while streaming them from disk.\n");
 	fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+	fprintf(stderr, "\t-U         Time the replays writing every cache line of each new payload\n");
+	fprintf(stderr, "\t           and reading it back before the free, so their locality counts.\n");
+	fprintf(stderr, "\t-T <timer> Time with gettod, itimer or fcyc (cycle counter, K-best),\n");
+	fprintf(stderr, "\t           pinned to <cpu>; fcyc is always pinned.\n");
 	fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
 	fprintf(stderr, "\t-V         Print additional debug info.\n");
+	fprintf(stderr, "\t-W <cache> Start each timed run warm, after an untimed run, or cold,\n");
+	fprintf(stderr, "\t           after evicting <bytes> (default 32MB) of cache. Without -W,\n");
+	fprintf(stderr, "\t           no untimed run is made.\n");
+	fprintf(stderr, "\t-X <how>   Sweep the mm options not fixed by -O, over a grid or\n");
+	fprintf(stderr, "\t           random:<n> configurations, and print the Pareto front.\n");
 }
@@ -2,7 +2,14 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Built with -DMEM_SYSTEM, as for the LD_PRELOAD shim, it never calls libc's
+ * malloc, which is then the student's own: the heap is a mapping the
+ * kernel fills with zero pages as it is touched, and shrinking the heap
+ * hands the pages above the new brk back, as sbrk does. Running out of
+ * heap is then reported to the caller alone, never on the host's stderr.
  */
+#define _GNU_SOURCE            /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,6 +17,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,20 +26,62 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_peak;      /* largest heap plus mapped size since the last reset */
+static char *mem_fresh;      /* highest brk ever; no byte from here up has been handed out */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;  /* guards mem_brk and the maps */
+
+/*
+ * Regions mapped by mem_map outside the heap, as the nodes of a treap
+ * keyed on the start address. A full heap may leave many small blocks
+ * in regions of their own, so every lookup takes expected O(log n) time.
+ */
+typedef struct mem_region_t {
+    char *addr;                  /* first byte of the region */
+    size_t len;                  /* length of the region in bytes */
+    struct mem_region_t *left;   /* regions at lower addresses */
+    struct mem_region_t *right;  /* regions at higher addresses, or next free record */
+    unsigned int priority;       /* random heap priority that keeps the tree balanced */
+} mem_region_t;
+
+#define MEM_REGION_CHUNK 256     /* records taken from the system at a time */
+
+static mem_region_t *mem_maps;    /* root of the treap of live regions */
+static mem_region_t *mem_pool;    /* free records, linked through right */
+static mem_region_t *mem_chunks;  /* blocks of records, linked through their first record */
+static unsigned int mem_seed = 1; /* xorshift state for treap priorities */
+static size_t mem_mapped;         /* total bytes in live regions */
+
+static void mem_update_peak(void);
+static mem_region_t **mem_find_map(void *addr);
+static mem_region_t *mem_region_alloc(void);
+static mem_region_t *mem_region_insert(mem_region_t *root, mem_region_t *node);
+static mem_region_t *mem_region_merge(mem_region_t *a, mem_region_t *b);
+static void mem_unmap_all(mem_region_t *root);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    /* allocate the storage we will use to model the available VM, zeroed like fresh pages */
+#ifdef MEM_SYSTEM
+    if ((mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			      -1, 0)) == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+#else
+    if ((mem_start_brk = (char *)calloc(1, MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_fresh = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +89,409 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+    mem_region_t *chunk;
+
+    mem_reset_brk();
+#ifdef MEM_SYSTEM
+    munmap(mem_start_brk, MAX_HEAP);
+#else
     free(mem_start_brk);
+#endif
+    while ((chunk = mem_chunks) != NULL) {
+	mem_chunks = chunk->right;
+#ifdef MEM_SYSTEM
+	munmap(chunk, MEM_REGION_CHUNK * sizeof(mem_region_t));
+#else
+	free(chunk);
+#endif
+    }
+    mem_pool = NULL;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap every region still mapped by mem_map
  */
 void mem_reset_brk()
 {
+    mem_unmap_all(mem_maps);
+    mem_maps = NULL;
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and returns the old brk. Safe to
+ *    call from several threads at once.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    pthread_mutex_lock(&mem_lock);
+    old_brk = mem_brk;
+    if (((mem_brk + incr) < mem_start_brk) || ((mem_brk + incr) > mem_max_addr)) {
+	pthread_mutex_unlock(&mem_lock);
 	errno = ENOMEM;
+#ifndef MEM_SYSTEM
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#endif
 	return (void *)-1;
     }
     mem_brk += incr;
+#ifdef MEM_SYSTEM
+    if (incr < 0)
+	mem_discard(mem_brk, old_brk - mem_brk);
+#endif
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
     return (void *)old_brk;
 }
 
+/*
+ * mem_sbrk_from - like mem_sbrk, but only moves the brk if it is still
+ *    at brk, so the new area is contiguous with the caller's last one
+ *    and a shrink gives back only the caller's own memory. Returns
+ *    (void *)-1 without complaint otherwise.
+ */
+void *mem_sbrk_from(void *brk, int incr)
+{
+    char *old_brk = (void *)-1;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((mem_brk == (char *)brk) && ((mem_brk + incr) >= mem_start_brk) &&
+	((mem_brk + incr) <= mem_max_addr)) {
+	old_brk = mem_brk;
+	mem_brk += incr;
+#ifdef MEM_SYSTEM
+	if (incr < 0)
+	    mem_discard(mem_brk, old_brk - mem_brk);
+#endif
+	mem_update_peak();
+    }
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)old_brk;
+}
+
+/*
+ * mem_fork_prepare, mem_fork_parent, mem_fork_child - pthread_atfork
+ *    handlers that hold mem_lock across a fork, so the child never
+ *    inherits it locked by a thread that does not exist there
+ */
+void mem_fork_prepare(void)
+{
+    pthread_mutex_lock(&mem_lock);
+}
+
+void mem_fork_parent(void)
+{
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_fork_child(void)
+{
+    pthread_mutex_init(&mem_lock, NULL);
+}
+
+/*
+ * mem_discard - tells the system that the len bytes at addr are unused,
+ *    so the whole pages among them can be reclaimed. The bytes read back
+ *    as zero afterwards; the partial pages at either end are untouched.
+ *    Returns the number of bytes discarded.
+ */
+size_t mem_discard(void *addr, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *lo = (char *)(((unsigned long)addr + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)(((unsigned long)addr + len) & ~(pagesize - 1));
+
+    if ((hi <= lo) || (madvise(lo, hi - lo, MADV_DONTNEED) < 0))
+	return 0;
+    return (size_t)(hi - lo);
+}
+
+/*
+ * mem_move - moves len bytes from src to dst, which must not overlap.
+ *    The whole pages are moved by remapping them when src and dst lie
+ *    at the same offset into a page, and src is left holding zeros.
+ *    Everything else is copied.
+ */
+void mem_move(void *dst, void *src, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *lo = (char *)(((unsigned long)src + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)(((unsigned long)src + len) & ~(pagesize - 1));
+    char *to = (char *)dst + (lo - (char *)src);
+
+    if ((((unsigned long)dst ^ (unsigned long)src) & (pagesize - 1)) || (hi <= lo) ||
+	(mremap(lo, hi - lo, hi - lo, MREMAP_MAYMOVE | MREMAP_FIXED, to) == MAP_FAILED)) {
+	memcpy(dst, src, len);
+	return;
+    }
+
+    /* Refill the hole the pages left behind */
+    if (mmap(lo, hi - lo, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "mem_move: mmap error\n");
+	exit(1);
+    }
+    memcpy(dst, src, lo - (char *)src);
+    memcpy(to + (hi - lo), hi, (char *)src + len - hi);
+}
+
+/*
+ * mem_map - maps a fresh zeroed region of len bytes outside the heap,
+ *    for allocations too large to carve from it. Returns the start
+ *    of the region, or NULL if it cannot be mapped.
+ */
+void *mem_map(size_t len)
+{
+    mem_region_t *node;
+    char *addr;
+
+    if ((addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	return NULL;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((node = mem_region_alloc()) == NULL) {
+	pthread_mutex_unlock(&mem_lock);
+	munmap(addr, len);
+	return NULL;
+    }
+    node->addr = addr;
+    node->len = len;
+    mem_maps = mem_region_insert(mem_maps, node);
+    mem_mapped += len;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)addr;
+}
+
+/*
+ * mem_unmap - unmaps a region returned by mem_map or mem_remap
+ */
+void mem_unmap(void *addr)
+{
+    mem_region_t **link, *node;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((link = mem_find_map(addr)) != NULL) {
+	node = *link;
+	*link = mem_region_merge(node->left, node->right);
+	munmap(node->addr, node->len);
+	mem_mapped -= node->len;
+	node->right = mem_pool;
+	mem_pool = node;
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * mem_remap - resizes a region returned by mem_map or mem_remap to len
+ *    bytes, moving it if it cannot grow in place. Returns the new start
+ *    of the region, or NULL, leaving the region as it was, on failure.
+ */
+void *mem_remap(void *addr, size_t len)
+{
+    mem_region_t **link, *node;
+    char *new_addr = NULL;
+
+    pthread_mutex_lock(&mem_lock);
+    if (((link = mem_find_map(addr)) != NULL) &&
+	((new_addr = mremap(addr, (*link)->len, len, MREMAP_MAYMOVE)) != MAP_FAILED)) {
+	/* The region may have moved, so it goes back in under its new key */
+	node = *link;
+	*link = mem_region_merge(node->left, node->right);
+	mem_mapped += len - node->len;
+	node->addr = new_addr;
+	node->len = len;
+	node->left = node->right = NULL;
+	mem_maps = mem_region_insert(mem_maps, node);
+	mem_update_peak();
+    } else {
+	new_addr = NULL;
+    }
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)new_addr;
+}
+
+/*
+ * mem_is_mapped - returns whether the bytes lo through hi all lie in
+ *    one region mapped by mem_map
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_region_t *p, *below = NULL;
+    int found;
+
+    /* Only the region starting closest below lo can hold it */
+    pthread_mutex_lock(&mem_lock);
+    for (p = mem_maps; p != NULL; ) {
+	if ((char *)lo < p->addr) {
+	    p = p->left;
+	} else {
+	    below = p;
+	    p = p->right;
+	}
+    }
+    found = (below != NULL) && ((char *)hi < below->addr + below->len);
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * mem_region_alloc - takes a region record from the pool, refilling it
+ *    MEM_REGION_CHUNK records at a time from libc's malloc, or straight
+ *    from mmap if malloc may be the student's. The first record of each
+ *    block links the blocks together. The caller holds mem_lock. Returns
+ *    NULL if there is no memory.
+ */
+static mem_region_t *mem_region_alloc(void)
+{
+    mem_region_t *p;
+    int i;
+
+    if (mem_pool == NULL) {
+#ifdef MEM_SYSTEM
+	if ((p = mmap(NULL, MEM_REGION_CHUNK * sizeof(mem_region_t), PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	    return NULL;
+#else
+	if ((p = malloc(MEM_REGION_CHUNK * sizeof(mem_region_t))) == NULL)
+	    return NULL;
+#endif
+	p[0].right = mem_chunks;
+	mem_chunks = &p[0];
+	for (i = 1; i < MEM_REGION_CHUNK; i++) {
+	    p[i].right = mem_pool;
+	    mem_pool = &p[i];
+	}
+    }
+    p = mem_pool;
+    mem_pool = p->right;
+    p->left = p->right = NULL;
+    mem_seed ^= mem_seed << 13;
+    mem_seed ^= mem_seed >> 17;
+    mem_seed ^= mem_seed << 5;
+    p->priority = mem_seed;
+    return p;
+}
+
+/*
+ * mem_region_insert - inserts node into the treap rooted at root and
+ *    returns the new root
+ */
+static mem_region_t *mem_region_insert(mem_region_t *root, mem_region_t *node)
+{
+    mem_region_t *child;
+
+    if (root == NULL)
+	return node;
+
+    if (node->addr < root->addr) {
+	child = root->left = mem_region_insert(root->left, node);
+	if (child->priority > root->priority) {  /* rotate right */
+	    root->left = child->right;
+	    child->right = root;
+	    return child;
+	}
+    } else {
+	child = root->right = mem_region_insert(root->right, node);
+	if (child->priority > root->priority) {  /* rotate left */
+	    root->right = child->left;
+	    child->left = root;
+	    return child;
+	}
+    }
+    return root;
+}
+
+/*
+ * mem_region_merge - joins two treaps, every region of a below every
+ *    region of b, and returns the new root
+ */
+static mem_region_t *mem_region_merge(mem_region_t *a, mem_region_t *b)
+{
+    if (a == NULL)
+	return b;
+    if (b == NULL)
+	return a;
+    if (a->priority > b->priority) {
+	a->right = mem_region_merge(a->right, b);
+	return a;
+    }
+    b->left = mem_region_merge(a, b->left);
+    return b;
+}
+
+/*
+ * mem_unmap_all - unmaps every region of the treap rooted at root and
+ *    returns its records to the pool
+ */
+static void mem_unmap_all(mem_region_t *root)
+{
+    if (root == NULL)
+	return;
+    mem_unmap_all(root->left);
+    mem_unmap_all(root->right);
+    munmap(root->addr, root->len);
+    root->right = mem_pool;
+    mem_pool = root;
+}
+
+/*
+ * mem_find_map - returns the link to the record of the region that starts
+ *    at addr, or NULL. The caller holds mem_lock.
+ */
+static mem_region_t **mem_find_map(void *addr)
+{
+    mem_region_t **link = &mem_maps;
+
+    while (*link != NULL) {
+	if ((char *)addr < (*link)->addr)
+	    link = &(*link)->left;
+	else if ((char *)addr > (*link)->addr)
+	    link = &(*link)->right;
+	else
+	    return link;
+    }
+    return NULL;
+}
+
+/*
+ * mem_update_peak - records the current heap plus mapped size if it is
+ *    the largest yet, and the brk if it is the highest yet. The caller
+ *    holds mem_lock.
+ */
+static void mem_update_peak(void)
+{
+    size_t size = (size_t)(mem_brk - mem_start_brk) + mem_mapped;
+
+    if (size > mem_peak)
+	mem_peak = size;
+    if (mem_brk > mem_fresh)
+	mem_fresh = mem_brk;
+}
+
+/*
+ * mem_fresh_lo - returns the highest brk the heap has ever had. No byte
+ *    at or above it has been handed out since mem_init, so all of them
+ *    still read as zero. Resetting or shrinking the heap leaves it alone.
+ */
+void *mem_fresh_lo(void)
+{
+    char *fresh;
+
+    pthread_mutex_lock(&mem_lock);
+    fresh = mem_fresh;
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)fresh;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +516,15 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest size in bytes of the heap
+ *    plus the regions mapped by mem_map since the heap was last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
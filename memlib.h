@@ -3,9 +3,21 @@
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void *mem_sbrk_from(void *brk, int incr);
+void mem_fork_prepare(void);
+void mem_fork_parent(void);
+void mem_fork_child(void);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
+void *mem_fresh_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_discard(void *addr, size_t len);
+void mem_move(void *dst, void *src, size_t len);
+void *mem_map(size_t len);
+void mem_unmap(void *addr);
+void *mem_remap(void *addr, size_t len);
+int mem_is_mapped(void *lo, void *hi);
 size_t mem_pagesize(void);
 
@@ -3,58 +3,198 @@
  * explicit linked lists and advanced reallocation heuristics.
  *
  * [Block Structure]
- * Each block has a 4-byte header and footer. The header contains the block
- * size, an allocation bit (LSB), and a reallocation tag (second LSB).
- * Free blocks contain pointers to their predecessor and successor in a
- * segregated free list.
+ * Each block has a 4-byte header. The header contains the block size, an
+ * allocation bit (LSB), a reallocation tag (second LSB), a prev_alloc
+ * bit (third LSB) that records whether the previous block is allocated,
+ * and, in the bits above ARENASHIFT, the index of the arena that owns it.
+ * Only free blocks carry a footer, so coalesce reads the previous block's
+ * footer only after prev_alloc says that block is free.
+ * Free blocks contain links to their predecessor and successor in a
+ * segregated free list. Links are 32-bit words: raw pointers in a 32-bit
+ * build, offsets from the start of the heap in a 64-bit build.
  * 
  * [Allocated Block]
  * +------------------------------------------+
- * | Header (size | prev_alloc | alloc | tag) | 4 bytes
+ * | Header (size | prev_alloc | tag | alloc) | 4 bytes
  * +------------------------------------------+
  * |                                          |
  * |                 Payload                  |
  * |                                          |
  * +------------------------------------------+
- * | Footer (size | prev_alloc | alloc)       | 4 bytes 
- * +------------------------------------------+
  *
  * [Free Block]
  * +--------------------------------------------+
- * | Header (size | prev_alloc | alloc=0 | tag) | 4 bytes
+ * | Header (size | prev_alloc | tag | alloc=0) | 4 bytes
  * +--------------------------------------------+
- * | SUCC (Pointer to next free block)          | 4 bytes
+ * | PRED (Link to previous free block)         | 4 bytes
  * +--------------------------------------------+
- * | PRED (Pointer to previous free block)      | 4 bytes
+ * | SUCC (Link to next free block)             | 4 bytes
  * +--------------------------------------------+
  * |              Payload(unused)               | 4 bytes
  * +--------------------------------------------+
- * | Footer (size | prev_alloc | alloc=0)       | 4 bytes
+ * | Footer (size | alloc=0)                    | 4 bytes
+ * +--------------------------------------------+
+ *
+ * [Large Free Block]
+ * +--------------------------------------------+
+ * | Header (size | prev_alloc | tag | alloc=0) | 4 bytes
+ * +--------------------------------------------+
+ * | LEFT (Link to left child)                  | 4 bytes
+ * +--------------------------------------------+
+ * | RIGHT (Link to right child)                | 4 bytes
+ * +--------------------------------------------+
+ * | PARENT (Link to parent)                    | 4 bytes
+ * +--------------------------------------------+
+ * | COLOR (RED or BLACK)                       | 4 bytes
  * +--------------------------------------------+
+ * |              Payload(unused)               |
+ * +--------------------------------------------+
+ * | Footer (size | alloc=0)                    | 4 bytes
+ * +--------------------------------------------+
+ *
+ * [Sized Free and Calloc]
+ * mm_free_sized takes the size the caller asked for, and one above SLABMAX
+ * skips the slab page lookup. The free list still comes from the header,
+ * as a block can be larger than its request.
+ * mm_calloc clears only the bytes that may be dirty. A mapping is always
+ * zero, and so is every byte a heap extension took from above memlib's
+ * fresh mark, except the free-block links and footer the allocator wrote
+ * there itself.
+ *
+ * [Batches]
+ * mm_malloc_batch carves blocks of one size back to back out of a free
+ * block, so a free block yields many blocks for one list removal and one
+ * split. mm_free_batch sorts its pointers by address and frees each run of
+ * physically adjacent blocks as a single block, with one coalesce and one
+ * list insertion per run. Slab, mapped and other arenas' blocks are handed
+ * to mm_malloc and mm_free one at a time.
+ *
+ * [Heap Checker]
+ * mm_check walks every segment of the calling thread's arena, which the
+ * unused word ahead of each prologue links to the arena's previous one, and
+ * then every free, quick and slab list. A DEBUG build can also check after
+ * each call: fully, fully every Nth call, or incrementally. Incremental
+ * checks cover the block a call returned and the lists insert_node,
+ * delete_node and the quick lists marked dirty, so their cost follows the
+ * lists a call touched rather than the size of the heap.
+ *
+ * [Statistics]
+ * Built with MM_STATS, each arena counts allocations, frees, splits and
+ * coalesces per size class, heap extensions, the nodes every fit search
+ * and insertion walks, and the fitting blocks skipped for their tags.
+ * mm_stats adds a histogram of the free blocks. Without MM_STATS the
+ * counting macros expand to nothing.
  *
  * [Free List Management]
- * Free blocks are managed using a segregated free list structure, where each
- * list holds blocks of a certain size class (powers of 2). Within each list,
- * blocks are sorted by size in descending order to approximate a best-fit policy.
- * Coalescing is performed immediately upon freeing a block or extending the heap.
+ * Free blocks are managed using a segregated free list structure. Blocks up
+ * to 256 bytes live in exact-size lists, one per 8-byte step, so any block
+ * in the request's list is a perfect fit. Blocks up to 512 bytes live in
+ * 16-byte-wide lists and blocks below 4KB in four lists per power of 2. These
+ * lists are sorted by size in ascending order, so the first fit found is the
+ * best fit. Blocks of 4KB and up are kept in a single red-black tree
+ * keyed on (size, address), which gives O(log n) best-fit insert, delete and
+ * search however many large blocks are free.
+ * mm_init_opts can trade this best fit for address-ordered first fit, next
+ * fit from a roving pointer, or best fit bounded to a few nodes per list;
+ * the first two keep the lists in address order instead. The tree is
+ * best fit under every policy.
+ * Two more options favour locality. addr_order_small keeps the exact-size
+ * lists in address order under every policy, which costs best fit nothing
+ * since their blocks are all one size, and packs small blocks low in the
+ * heap. prefer_adjacent has mm_malloc carve a block from a free neighbour
+ * of the block it handed out last, at the end that touches it, if that
+ * neighbour is in the class the search would start with anyway, so blocks
+ * allocated one after another lie side by side.
+ * Coalescing is performed when a block is released to the free lists or the
+ * heap is extended.
+ *
+ * [Quick Lists]
+ * Freed blocks of up to 256 bytes are first cached, still marked allocated,
+ * in per-size LIFO quick lists, and mm_malloc hands them back in O(1) to the
+ * next request of the same size. A quick list that overflows QUICKLISTMAX is
+ * flushed to the free lists and coalesced as a batch, and all quick lists
+ * are flushed before mm_malloc gives up and extends the heap.
+ *
+ * [Slab Front-End]
+ * Requests of up to 64 bytes bypass the free lists. Each 8-byte size class
+ * owns runs: page-aligned 4KB allocated blocks that hold a small header, a
+ * bitmap of free slots and headerless objects of one size. A page bitmap
+ * over the heap tells mm_free whether a pointer lies in a run; masking the
+ * pointer down to its page then yields the run header. Runs that have
+ * free slots are linked per class, and a run that empties is returned to
+ * the free lists unless it is the last one of its class. Runs are used only
+ * once SLABMINLIVE small blocks are live in the main heap, so a handful of
+ * small blocks never pins a whole run.
+ *
+ * [Mapped Blocks]
+ * Requests of MMAPTHRESHOLD bytes and up never touch the heap. Each gets a
+ * mapping of its own from mem_map, which starts with the mapping length and
+ * a MAPPED_HDR header ahead of the payload. mm_free unmaps it and
+ * mm_realloc resizes it with mem_remap. A pointer outside the heap's
+ * MAX_HEAP bytes is a mapped block, so no lookup is needed to find one.
+ * Once the break can grow no further, smaller requests that fit no free
+ * block are mapped the same way, so the heap's size limit is not the
+ * allocator's.
+ *
+ * [Aligned Blocks]
+ * mm_memalign searches the free lists for a block that holds the request
+ * from its first suitably aligned address on, and carves it there with
+ * the same split as a slab run: the leading slack becomes a free block of
+ * its own and the tail is split off as usual. The result is an ordinary
+ * heap block that mm_free and mm_realloc treat like any other. An aligned
+ * mapped block starts part-way into its mapping, and the padding word of
+ * its header counts the bytes skipped. That word is 4 bytes, so alignments
+ * above MAPALIGNMAX (2GB) are refused.
+ *
+ * [Arenas]
+ * All allocator state above lives in an arena, and each thread attaches to
+ * its own arena on its first call, so threads never share a free list and
+ * take no lock outside mem_sbrk. An arena grows its heap in place while no
+ * other arena has moved the break; otherwise it starts a new segment with
+ * its own prologue and epilogue. Freeing another arena's block pushes it
+ * onto that arena's lock-free remote-free stack, which the owner drains on
+ * its next mm_malloc. A thread's arena is released when the thread exits
+ * and adopted, free blocks and all, by the next thread that needs one.
+ *
+ * [Returning Memory]
+ * A free block of at least TRIMTHRESHOLD at the top of an arena's heap
+ * shrinks the break, if no other arena has moved it. Whole pages inside
+ * other free blocks of at least DISCARDTHRESHOLD are discarded with
+ * madvise, so the system can reclaim them while the heap keeps its shape.
  *
  * [Reallocation Strategy]
- * Reallocation is heavily optimized using a reallocation tag and a buffer.
- * - Reallocation Tag: The second LSB in a block's header. When a block is
- * reallocated, the next physical block is "tagged" as reserved. This tagged
- * block is skipped by mm_malloc, preserving it for the next potential
- * reallocation of the preceding block. This avoids costly memory moves.
- * - Reallocation Buffer: A small buffer is added to reallocated blocks to
- * absorb minor size increases without needing to resize the block immediately.
+ * Reallocation is heavily optimized using a reallocation tag and a reserve.
+ * - Reallocation History: Each arena keeps a small side table, indexed by
+ * block address, of how many times recent blocks were reallocated and the
+ * largest step they grew by. A block reallocated for the first time
+ * reserves nothing. After that its reserve starts at the larger of its step
+ * and the realloc_buffer option (128 bytes by default) and doubles with
+ * each reallocation, up to REALLOCGROWMAX times, but never exceeds the
+ * block itself.
+ * - Reallocation Tag: The second LSB in a block's header. When a block with
+ * less than its reserve to spare is reallocated, the next physical block is
+ * "tagged" as reserved. This tagged block is skipped by mm_malloc,
+ * preserving it for the next reallocation of the preceding block. This
+ * avoids costly memory moves.
+ * - Reallocation Reserve: A block that has to move, or that grows by
+ * extending the heap, is given its reserve on top of the requested size,
+ * so a block that keeps growing moves geometrically less often.
+ * - A block that cannot grow forwards grows backwards into a free previous
+ * block. A block that keeps growing takes its reserve, and at least its own
+ * size, from it on each move, as every move copies the payload. A large
+ * block that has to move is placed at the same offset into a page as
+ * before, so its whole pages are remapped rather than copied.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -74,18 +214,91 @@ team_t team = {
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
 
 #define WSIZE           4             /* Word and header/footer size (bytes) */
+#define MINBLOCKSIZE    16            /* Header, two links and footer of a free block */
 #define DSIZE           8             /* Double word size (bytes) */
-#define INITCHUNKSIZE   (1 << 6)      /* Initial heap size (64 bytes) */
-#define CHUNKSIZE       (1 << 12)     /* Incremental heap size (4KB) */
-#define SEGLISTNUM      20            /* Number of segregated lists */
-#define REALLOC_BUFFER  (1 << 7)      /* Buffer size for reallocation (128 bytes) */
+#define SMALLCLASSMAX   (1 << 8)      /* Largest size with its own exact-size list (256 bytes) */
+#define SMALLCLASSNUM   ((SMALLCLASSMAX >> 3) - 1)  /* Exact-size lists for 16..256 bytes */
+#define TREECUTOFF      (1 << 12)     /* Smallest size kept in the red-black tree (4KB) */
+#define MEDCLASSMAX     (1 << 9)      /* Largest size with a 16-byte-wide list (512 bytes) */
+#define MEDCLASSNUM     ((MEDCLASSMAX - SMALLCLASSMAX) >> 4)  /* 16-byte-wide lists for 264..512 bytes */
+#define SEGLISTNUM      (SMALLCLASSNUM + MEDCLASSNUM + 12 + 1)  /* Plus 4 lists per power of 2 below 4KB, and the tree (<= 64) */
+#define TREE_LIST       (SEGLISTNUM - 1)            /* Class of blocks of at least TREECUTOFF */
+#define REALLOCGROWMAX  4             /* Doublings of the reserve of a block that keeps growing */
+#define REALLOCHISTBITS 6             /* Log2 of the blocks whose reallocations an arena tracks */
+#define BATCHSPANMAX    (1 << 20)     /* Largest span mm_malloc_batch asks for at once (1MB) */
+#define PAGEMOVEMIN     (1 << 19)     /* Smallest block a reallocation moves by remapping pages (512KB) */
+#define QUICKMAX        SMALLCLASSMAX /* Largest block size cached in a quick list */
+#define QUICKLISTNUM    SMALLCLASSNUM /* One quick list per exact block size */
+#define QUICKLISTMAX    8             /* Blocks a quick list caches before it is flushed (0 disables) */
+#define SLABMAX         64            /* Largest request served by the slab front-end */
+#define SLABCLASSNUM    (SLABMAX >> 3)              /* One slab class per 8 bytes */
+#define RUNSHIFT        12
+#define RUNSIZE         (1 << RUNSHIFT)             /* Size and alignment of a slab run (4KB) */
+#define RUNHDRSIZE      (4 * WSIZE + (RUNMAPWORDS << 3))  /* Run header: size, count, links, bitmap */
+#define RUNMAPWORDS     8                           /* 64-bit free-slot bitmap words per run */
+#define SLABMINLIVE     32            /* Live small blocks before runs are used */
+#define SLABBLOCKMAX    (SLABMAX + DSIZE + MINBLOCKSIZE)  /* Largest main-heap block a slab-sized request can get */
+#define TRIMTHRESHOLD   (1 << 17)     /* Free top block size that shrinks the heap (128KB) */
+#define TRIMKEEP        (1 << 12)     /* Free top block left behind by a trim (4KB) */
+#define DISCARDTHRESHOLD (1 << 20)    /* Free block size whose whole pages are discarded (1MB) */
+#define MMAPTHRESHOLD   (1 << 20)     /* Smallest request given a mapping of its own (1MB) */
+#define MAPHDRSIZE      (DSIZE << 1)  /* Mapping length, padding and header ahead of a mapped payload */
+#define MAPALIGNMAX     (1UL << 31)   /* Largest alignment whose padding the 4-byte padding word holds */
+#define MAPPED_HDR      0x3           /* Header of a mapped block: size 0, allocated and tagged */
+#define ARENASHIFT      25            /* Header bits above the size hold the owning arena */
+#define MAXARENAS       64            /* Arenas, and so threads using the allocator at once (<= 128) */
+
+#if SEGLISTNUM > MM_STATS_CLASSES
+#error "mm_stats_t has too few classes for the segregated lists"
+#endif
+
+#if MAX_HEAP > (1 << ARENASHIFT)
+#error "MAX_HEAP does not fit in the size bits of a header"
+#endif
 
 /* --- Helper Macros --- */
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-/* Pack a size and allocation status into a word */
-#define PACK(size, alloc) ((size) | (alloc))
+/* Pack a size and allocation status into a word, tagged with this thread's arena */
+#define PACK(size, alloc) ((size) | (alloc) | arena->tag)
+
+/* Header bit recording that the previous block is allocated */
+#define PREV_ALLOC 0x4
+
+/* Occupancy bitmap operations, one bit per segregated list */
+#define LIST_BIT(list) (1ULL << (list))
+#define MARK_LIST(list) (arena->seglist_bitmap |= LIST_BIT(list))
+#define CLEAR_LIST(list) (arena->seglist_bitmap &= ~LIST_BIT(list))
+
+/* Heap checker hooks: record the lists an operation changed, check after it */
+#ifdef DEBUG
+#define TOUCH_LIST(list) (arena->dirty_lists |= LIST_BIT(list))
+#define TOUCH_QUICK(q) (arena->dirty_quick |= 1ULL << (q))
+#define CHECK_HEAP(bp) do { if (check_mode != MM_CHECK_OFF) check_op(bp); } while (0)
+#else
+#define TOUCH_LIST(list)
+#define TOUCH_QUICK(q)
+#define CHECK_HEAP(bp)
+#endif
+
+/* Profiling counters of mm_stats, compiled in only with -DMM_STATS */
+#ifdef MM_STATS
+#define STAT_ADD(field, n) (arena->stats.field += (n))
+#define STAT_CLASS(size, field, n) (arena->stats.classes[get_list_index(size)].field += (n))
+#define STAT_STEP() (stat_walk++)
+#define STAT_WALK(kind) do { \
+        arena->stats.kind##_searches++; \
+        arena->stats.kind##_walked += stat_walk; \
+        arena->stats.kind##_walked_max = MAX(arena->stats.kind##_walked_max, stat_walk); \
+        stat_walk = 0; \
+    } while (0)
+#else
+#define STAT_ADD(field, n)
+#define STAT_CLASS(size, field, n)
+#define STAT_STEP()
+#define STAT_WALK(kind)
+#endif
 
 /* Read and write a word at address p */
 #define GET(p) (*(unsigned int *)(p))
@@ -98,196 +311,829 @@ team_t team = {
 #define PUT_NO_REALLOC(p, val) (*(unsigned int *)(p) = (val))
 
 /* Read block size and allocation status */
-#define GET_SIZE(p) (GET(p) & ~0x7)
+#define SIZE_MASK ((1U << ARENASHIFT) - 8)
+#define GET_SIZE(p) (GET(p) & SIZE_MASK)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Previous-allocated bit operations */
+#define SET_PREV_ALLOC(p) (PUT(p, GET(p) | PREV_ALLOC))
+#define CLEAR_PREV_ALLOC(p) (PUT(p, GET(p) & ~PREV_ALLOC))
 
 /* Reallocation tag operations */
 #define GET_REALLOC(p) (GET(p) & 0x2)
 #define SET_REALLOC(p) (PUT(p, GET(p) | 0x2))
 #define REMOVE_REALLOC(p) (PUT(p, GET(p) & ~0x2))
 
-/* Compute address of header and footer */
+/* Arena that owns the block at bp, or the run holding a slab object */
+#define GET_ARENA(p) (GET(p) >> ARENASHIFT)
+#define ARENA_OF(bp) (&arenas[GET_ARENA(HDRP(IS_SLAB(bp) ? RUN_OF(bp) : (char *)(bp)))])
+
+/* Does this thread own an arena of the current heap (attaching one if not) */
+#define ARENA_READY() (((arena != NULL) && (arena_gen == heap_gen)) || (arena_attach() != NULL))
+
+/* Compute address of header and footer (free blocks only) */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Compute address of next and previous physical blocks */
+/* Compute address of next and previous (free only) physical blocks */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-/* Access pointers for free blocks in the segregated list */
-#define PRED_PTR(bp) ((char **)(bp))
-#define SUCC_PTR(bp) ((char **)((char *)(bp) + WSIZE))
+/*
+ * Free-list links are stored as 32-bit words so that both fit in the
+ * 16-byte minimum block. On LP64 a link is an offset from the start of
+ * the heap; offset 0 is the alignment padding word and never a free
+ * block, so it doubles as NULL.
+ */
+#if defined(__LP64__) || defined(_LP64)
+#define PTR_TO_LINK(p) ((p) ? (unsigned int)((char *)(p) - heap_base) : 0)
+#define LINK_TO_PTR(l) ((l) ? (void *)(heap_base + (l)) : NULL)
+#else
+#define PTR_TO_LINK(p) ((unsigned int)(p))
+#define LINK_TO_PTR(l) ((void *)(l))
+#endif
+
+/* Access links for free blocks in the segregated list */
+#define PRED_PTR(bp) ((char *)(bp))
+#define SUCC_PTR(bp) ((char *)(bp) + WSIZE)
 
-#define PRED(bp) (*(char **)(bp))
-#define SUCC(bp) (*(char **)((char *)(bp) + WSIZE))
+#define PRED(bp) LINK_TO_PTR(GET(PRED_PTR(bp)))
+#define SUCC(bp) LINK_TO_PTR(GET(SUCC_PTR(bp)))
 
+#define SET_PRED(bp, p) PUT(PRED_PTR(bp), PTR_TO_LINK(p))
+#define SET_SUCC(bp, p) PUT(SUCC_PTR(bp), PTR_TO_LINK(p))
+
+/* Access links and color for free blocks in the red-black tree */
+#define RED   1
+#define BLACK 0
+
+#define LEFT_PTR(bp)   ((char *)(bp))
+#define RIGHT_PTR(bp)  ((char *)(bp) + WSIZE)
+#define PARENT_PTR(bp) ((char *)(bp) + (2 * WSIZE))
+#define COLOR_PTR(bp)  ((char *)(bp) + (3 * WSIZE))
+
+#define LEFT(bp)   LINK_TO_PTR(GET(LEFT_PTR(bp)))
+#define RIGHT(bp)  LINK_TO_PTR(GET(RIGHT_PTR(bp)))
+#define PARENT(bp) LINK_TO_PTR(GET(PARENT_PTR(bp)))
+#define COLOR(bp)  GET(COLOR_PTR(bp))
+
+#define SET_LEFT(bp, p)   PUT(LEFT_PTR(bp), PTR_TO_LINK(p))
+#define SET_RIGHT(bp, p)  PUT(RIGHT_PTR(bp), PTR_TO_LINK(p))
+#define SET_PARENT(bp, p) PUT(PARENT_PTR(bp), PTR_TO_LINK(p))
+#define SET_COLOR(bp, c)  PUT(COLOR_PTR(bp), (c))
+
+/* A missing (NULL) child counts as black */
+#define IS_RED(bp) ((bp) != NULL && COLOR(bp) == RED)
+
+/* Tree order: by size, ties broken by address */
+#define TREE_LESS(a, b) ((GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b))) || \
+                         ((GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b))) && ((char *)(a) < (char *)(b))))
+
+#define TREE_ROOT (arena->segregated_free_lists[TREE_LIST])
+
+/* Quick list of a block size */
+#define QUICK_INDEX(size) (((size) >> 3) - 2)
+
+/* Slab class of a request and object size of a class */
+#define SLAB_CLASS(size) (((size) - 1) >> 3)
+#define SLAB_OBJSIZE(class) (((class) + 1) << 3)
+
+/* Number of objects of a given size that fit in one run */
+#define RUN_NOBJ(objsize) ((RUNSIZE - WSIZE - RUNHDRSIZE) / (objsize))
+
+/* Access fields of a slab run header */
+#define RUN_OBJSIZE(run) GET(run)
+#define RUN_NFREE(run)   GET((char *)(run) + WSIZE)
+#define RUN_NEXT(run)    LINK_TO_PTR(GET((char *)(run) + (2 * WSIZE)))
+#define RUN_PREV(run)    LINK_TO_PTR(GET((char *)(run) + (3 * WSIZE)))
+#define RUN_MAP(run)     ((unsigned long long *)((char *)(run) + (4 * WSIZE)))
+#define RUN_OBJS(run)    ((char *)(run) + RUNHDRSIZE)
+
+#define SET_RUN_NFREE(run, n) PUT((char *)(run) + WSIZE, (n))
+#define SET_RUN_NEXT(run, p)  PUT((char *)(run) + (2 * WSIZE), PTR_TO_LINK(p))
+#define SET_RUN_PREV(run, p)  PUT((char *)(run) + (3 * WSIZE), PTR_TO_LINK(p))
+
+/* Page-bitmap lookups: is ptr inside a run, and which run */
+#define PAGE_INDEX(ptr) ((unsigned long)((char *)(ptr) - heap_base) >> RUNSHIFT)
+#define IS_SLAB(ptr) ((slab_pages[PAGE_INDEX(ptr) >> 6] >> (PAGE_INDEX(ptr) & 63)) & 1)
+#define MARK_SLAB(run) __atomic_fetch_or(&slab_pages[PAGE_INDEX(run) >> 6], 1ULL << (PAGE_INDEX(run) & 63), __ATOMIC_RELAXED)
+#define CLEAR_SLAB(run) __atomic_fetch_and(&slab_pages[PAGE_INDEX(run) >> 6], ~(1ULL << (PAGE_INDEX(run) & 63)), __ATOMIC_RELAXED)
+#define RUN_OF(ptr) (heap_base + (PAGE_INDEX(ptr) << RUNSHIFT))
+
+/* Reallocation history: the side-table entry of a block and the tail it reserves */
+#define REALLOC_HIST(bp) (&arena->realloc_hist[(PTR_TO_LINK(bp) * 2654435761U) >> (32 - REALLOCHISTBITS)])
+#define REALLOC_RESERVE(count, step, size) \
+    ((count) < 2 ? 0 : MIN(MAX((step), opts.realloc_buffer) << MIN((count) - 2, REALLOCGROWMAX), \
+                           MAX((size), opts.realloc_buffer)))
+
+/*
+ * Mapped blocks live outside the heap. The mapping length sits MAPHDRSIZE
+ * bytes ahead of the payload, and the padding word after it counts the
+ * bytes an aligned block skipped at the start of the mapping.
+ */
+#define IS_MAPPED(ptr) ((unsigned long)((char *)(ptr) - heap_base) >= MAX_HEAP)
+#define MAP_PAD(bp) GET((char *)(bp) - DSIZE)
+#define MAP_BASE(bp) ((char *)(bp) - MAPHDRSIZE - MAP_PAD(bp))
+#define MAP_LEN(bp) (*(size_t *)((char *)(bp) - MAPHDRSIZE))
+#define MAP_LENGTH(size) (((size) + MAPHDRSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+
+
+/* --- Arenas --- */
+typedef struct {
+    unsigned int block;                        /* Link to the block's payload, 0 if unused */
+    unsigned int size;                         /* Block size its last reallocation left */
+    unsigned int step;                         /* Largest growth seen, in bytes */
+    unsigned int count;                        /* Reallocations seen, capped */
+} realloc_hist_t;
+
+typedef struct {
+    void *segregated_free_lists[SEGLISTNUM];   /* Segregated free lists for different size classes */
+    unsigned long long seglist_bitmap;         /* Bit i set iff segregated_free_lists[i] is non-empty */
+    void *slab_runs[SLABCLASSNUM];             /* Runs with at least one free slot, per class */
+    int slab_live;                             /* Live slab-sized blocks in the main heap */
+    void *quick_lists[QUICKLISTNUM];           /* Deferred-free blocks, one LIFO per size */
+    int quick_counts[QUICKLISTNUM];            /* Length of each quick list */
+    int quick_total;                           /* Blocks held in all quick lists */
+    char *heap_end;                            /* End of the arena's newest heap segment */
+    char *segments;                            /* Prologue of the newest segment, which links to the one before */
+    void *rover;                               /* Free block where the next MM_FIT_NEXT search resumes */
+    char *last_alloc;                          /* Block mm_malloc handed out last, NULL once freed */
+    char *fresh_lo;                            /* Bytes of the last extension still known zero... */
+    char *fresh_hi;                            /* ...up to here; empty if fresh_lo >= fresh_hi */
+    realloc_hist_t realloc_hist[1 << REALLOCHISTBITS];  /* How recently reallocated blocks grew */
+    unsigned int tag;                          /* Arena index, shifted into header position */
+    unsigned int gen;                          /* Heap generation the state above belongs to */
+    unsigned int owner;                        /* Generation of the thread using it, 0 if none */
+    unsigned int remote_frees;                 /* Link to a stack of blocks freed by other threads */
+    unsigned long long dirty_lists;            /* Segregated lists changed since the last check */
+    unsigned long long dirty_quick;            /* Quick lists changed since the last check */
+    int check_ops;                             /* Operations since the last sampled check */
+#ifdef MM_STATS
+    mm_stats_t stats;                          /* Counters reported by mm_stats */
+#endif
+} arena_t;
 
 /* --- Global Variables & Function Prototypes --- */
-static void *segregated_free_lists[SEGLISTNUM];      /* Segregated free lists for different size classes */
+static arena_t arenas[MAXARENAS];                    /* Per-thread allocator state */
+static __thread arena_t *arena;                      /* This thread's arena */
+static __thread unsigned int arena_gen;              /* Heap generation this thread's arena is from */
+static unsigned int heap_gen;                        /* Bumped by every mm_init */
+static pthread_key_t arena_key;                      /* Releases a thread's arena when it exits */
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+static char *heap_base;                              /* First byte of the heap, base of free-list links */
+static mm_opts_t opts = MM_OPTS_DEFAULT;             /* Placement policy of the current heap */
+static unsigned long long lists_by_addr;             /* Bit i set iff list i is in address rather than size order */
+static int check_mode;                               /* MM_CHECK_* mode of the consistency checks */
+static int check_period;                             /* Operations between sampled checks */
+#ifdef MM_STATS
+static __thread unsigned long stat_walk;             /* Nodes visited by the current search */
+#endif
+static unsigned long long slab_pages[MAX_HEAP / RUNSIZE / 64];  /* Bit set iff the heap page is a run */
 
+static void arena_key_init(void);                    /* Register the thread-exit hook */
+static arena_t *arena_attach(void);                  /* Claim an arena for this thread */
+static void arena_free_remote(arena_t *owner, void *ptr);  /* Hand a block back to its arena */
+static void arena_drain(void);                       /* Free the blocks other threads handed back */
+
+static inline int get_list_index(size_t size);       /* Map a block size to its size class */
 static void *extend_heap(size_t size);               /* Extend the heap */
 static void *coalesce(void *ptr);                    /* Coalesce free blocks */
+static void free_block(void *ptr);                   /* Release a block to the free lists */
+static void local_free(void *ptr);                   /* Free a block owned by this thread's arena */
+static void heap_free(void *ptr);                    /* Free a main-heap block of this thread's arena */
+static void heap_release(void *ptr, char *lo, char *hi);  /* Return a large free block's memory */
+static void *find_fit(size_t asize);                 /* Search the free lists for a fit */
+static void *adjacent_fit(size_t asize, int *back);  /* Find a fit next to the last allocation */
+static void *aligned_fit(size_t asize, size_t alignment);  /* Search the free lists for an aligned fit */
+static void *list_fit(void *ptr, void *stop, size_t asize);  /* Search one free list for a fit */
+static void quick_flush(int q);                      /* Release every block in a quick list */
 static void *place(void *ptr, size_t asize);         /* Place a block */
+static void *place_at(void *ptr, size_t asize, int back);  /* Place a block at either end */
+static size_t place_batch(void *ptr, size_t asize, size_t n, void **out);  /* Carve several blocks */
+static int ptr_compare(const void *a, const void *b);     /* Order pointers by address */
 static void insert_node(void *ptr, size_t size);     /* Insert a free block into the segregated list */
 static void delete_node(void *ptr);                  /* Delete a free block from the segregated list */
+static void tree_insert(void *ptr);                  /* Insert a large free block into the tree */
+static void tree_delete(void *ptr);                  /* Delete a large free block from the tree */
+static void *tree_find_fit(size_t asize);            /* Find the best untagged fit in the tree */
+static void *slab_alloc(size_t size);                /* Allocate a tiny object from a slab run */
+static void slab_free(void *ptr);                    /* Return a tiny object to its slab run */
+static void *map_alloc(size_t size, size_t alignment);  /* Give a huge request its own mapping */
+static void *heap_exhausted(size_t size, size_t alignment); /* Map a block the full heap cannot hold */
+static void *map_realloc(void *ptr, size_t size);    /* Resize a mapped block */
+static void *grow_backward(void *ptr, size_t asize,
+                           size_t reserve);           /* Grow a block into the free block before it */
+static void *move_pages(void *ptr, size_t asize);    /* Move a large block by remapping its pages */
+static void *realloc_finish(void *ptr, void *new_ptr, size_t new_size,
+                            unsigned int count, size_t step);  /* Reserve and record a reallocation */
+static void *malloc_block(size_t size);              /* mm_malloc without the heap check */
+static void *memalign_block(size_t alignment, size_t size);  /* mm_memalign without the heap check */
+static void *realloc_block(void *ptr, size_t size);  /* mm_realloc without the heap check */
+static int check_heap(void);                         /* Check every block and list of the arena */
+#ifdef DEBUG
+static int check_touched(void *bp);                  /* Check the lists an operation changed */
+static void check_op(void *bp);                      /* Check the heap after an operation */
+#endif
 
 /*
- * mm_init - Initializes the memory manager.
+ * mm_init - Initializes the memory manager with the default placement
+ * policy.
  */
 int mm_init(void) {
-    char *heap_start;
+    static const mm_opts_t defaults = MM_OPTS_DEFAULT;
 
-    for (int i = 0; i < SEGLISTNUM; i++) {
-        segregated_free_lists[i] = NULL;
-    }
+    return mm_init_opts(&defaults);
+}
 
-    if ((long)(heap_start = mem_sbrk(WSIZE << 2)) == -1)
+/*
+ * mm_init_opts - Initializes the memory manager with the given placement
+ * policy and sizes, rounding chunk_size and realloc_buffer up to ALIGNMENT.
+ * Starts a new heap generation, which retires every arena of the old heap,
+ * and attaches the calling thread to a fresh arena. Must not run
+ * concurrently with other calls. Returns -1 if an option is out of range.
+ */
+int mm_init_opts(const mm_opts_t *o) {
+    if ((o->fit < MM_FIT_BEST) || (o->fit > MM_FIT_GOOD) || (o->fit_candidates == 0) ||
+        (o->split_min < MINBLOCKSIZE) || (o->chunk_size < MINBLOCKSIZE) ||
+        (o->init_chunk_size < MINBLOCKSIZE) || (o->chunk_size > MAX_HEAP))
         return -1;
+    opts = *o;
+    opts.chunk_size = ALIGN(opts.chunk_size);
+    opts.realloc_buffer = ALIGN(opts.realloc_buffer);
+    if ((opts.fit == MM_FIT_FIRST) || (opts.fit == MM_FIT_NEXT))
+        lists_by_addr = ~0ULL;
+    else
+        lists_by_addr = opts.addr_order_small ? LIST_BIT(SMALLCLASSNUM) - 1 : 0;
+
+    pthread_once(&arena_key_once, arena_key_init);
 
-    PUT_NO_REALLOC(heap_start, 0);
-    PUT_NO_REALLOC(heap_start + (1 * WSIZE), PACK(DSIZE, 1));   /* Prologue block */
-    PUT_NO_REALLOC(heap_start + (2 * WSIZE), PACK(DSIZE, 1));   /* Next block */
-    PUT_NO_REALLOC(heap_start + (3 * WSIZE), PACK(0, 1));       /* Epilogue block */
+    __atomic_store_n(&heap_gen, heap_gen + 1, __ATOMIC_RELEASE);
+    heap_base = mem_heap_lo();
+    memset(slab_pages, 0, sizeof(slab_pages));
+
+    if (arena_attach() == NULL)
+        return -1;
 
-    /* Extend the heap */
-    if (extend_heap(INITCHUNKSIZE) == NULL)
+    /* The first extension lays down the prologue and epilogue */
+    if (extend_heap(opts.init_chunk_size) == NULL)
         return -1;
 
     return 0;
 }
 
 /*
- * extend_heap - Extends the heap with a new free block.
+ * arena_release - Hands a thread's arena back when the thread exits. The
+ * arena keeps its heap and free blocks for the next thread to attach.
  */
-static void *extend_heap(size_t size) {
+static void arena_release(void *a) {
+    unsigned int gen = arena_gen;
+
+    __atomic_compare_exchange_n(&((arena_t *)a)->owner, &gen, 0, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/*
+ * arena_key_init - Registers arena_release as a thread-exit destructor.
+ */
+static void arena_key_init(void) {
+    pthread_key_create(&arena_key, arena_release);
+}
+
+/*
+ * arena_reset - Empties an arena for the current heap generation.
+ */
+static void arena_reset(arena_t *a, int index, unsigned int gen) {
+    memset(a, 0, sizeof(arena_t));
+    a->tag = (unsigned int)index << ARENASHIFT;
+    a->gen = gen;
+    a->owner = gen;
+}
+
+/*
+ * arena_attach - Claims the first arena no thread of the current heap
+ * generation is using. An arena left over from an earlier generation is
+ * reset first. Returns NULL if all MAXARENAS arenas are taken.
+ */
+static arena_t *arena_attach(void) {
+    unsigned int gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
+    unsigned int owner;
+    arena_t *a;
+
+    for (int i = 0; i < MAXARENAS; i++) {
+        a = &arenas[i];
+        owner = __atomic_load_n(&a->owner, __ATOMIC_RELAXED);
+        if (owner == gen)
+            continue;
+        if (!__atomic_compare_exchange_n(&a->owner, &owner, gen, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        if (a->gen != gen)
+            arena_reset(a, i, gen);
+        arena = a;
+        arena_gen = gen;
+        pthread_setspecific(arena_key, a);
+        return a;
+    }
+    return NULL;
+}
+
+/*
+ * arena_free_remote - Pushes a block onto the remote-free stack of the
+ * arena that owns it. The link goes in the block's first payload word.
+ */
+static void arena_free_remote(arena_t *owner, void *ptr) {
+    unsigned int head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        PUT(ptr, head);
+    } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, PTR_TO_LINK(ptr), 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * arena_drain - Takes the whole remote-free stack of this thread's arena
+ * and frees its blocks locally. Only the owner pops, so there is no ABA.
+ */
+static void arena_drain(void) {
+    unsigned int link = __atomic_exchange_n(&arena->remote_frees, 0, __ATOMIC_ACQUIRE);
     void *ptr;
+
+    while ((ptr = LINK_TO_PTR(link)) != NULL) {
+        link = GET(ptr);
+        local_free(ptr);
+    }
+}
+
+/*
+ * extend_heap - Extends the arena's heap with a new free block. If another
+ * arena has moved the break since, the block starts a new segment of its
+ * own, fenced by a prologue and an epilogue so coalescing stays inside it.
+ * Records which bytes of the block are still zero, for mm_calloc.
+ */
+static void *extend_heap(size_t size) {
+    char *ptr, *seg;
+    char *fresh = mem_fresh_lo();
     size_t asize = ALIGN(size);
 
-    if ((ptr = mem_sbrk(asize)) == (void *)-1)
-        return NULL;
+    STAT_ADD(extends, 1);
+    if ((ptr = mem_sbrk_from(arena->heap_end, asize)) == (void *)-1) {
+        if ((seg = mem_sbrk(asize + (WSIZE << 2))) == (void *)-1)
+            return NULL;
+        PUT_NO_REALLOC(seg, PTR_TO_LINK(arena->segments));   /* Link to the previous segment */
+        PUT_NO_REALLOC(seg + (1 * WSIZE), PACK(DSIZE, 1));   /* Prologue block */
+        PUT_NO_REALLOC(seg + (2 * WSIZE), PACK(DSIZE, 1));   /* Next block */
+        PUT_NO_REALLOC(seg + (3 * WSIZE), PACK(0, PREV_ALLOC | 1));  /* Epilogue block */
+        ptr = seg + (WSIZE << 2);
+        arena->segments = seg + (2 * WSIZE);
+    }
+    arena->heap_end = ptr + asize;
 
-    PUT_NO_REALLOC(HDRP(ptr), PACK(asize, 0));          /* Set header */
+    /* The new block's header replaces the old epilogue */
+    PUT_NO_REALLOC(HDRP(ptr), PACK(asize, GET_PREV_ALLOC(HDRP(ptr))));  /* Set header */
     PUT_NO_REALLOC(FTRP(ptr), PACK(asize, 0));          /* Set footer */
     PUT_NO_REALLOC(HDRP(NEXT_BLKP(ptr)), PACK(0, 1));   /* Set epilogue header */
 
-    /* Insert the new free block into the segregated list */
-    insert_node(ptr, asize);
-    return coalesce(ptr);
+    /* Merge with a free top block and insert into the segregated list */
+    ptr = coalesce(ptr);
+
+    /* Bytes above the old fresh mark are zero, bar the links and footer just written */
+    arena->fresh_lo = MAX(fresh, ptr + (WSIZE << 2));
+    arena->fresh_hi = arena->heap_end - DSIZE;
+    return ptr;
+}
+
+/*
+ * get_list_index - Returns the segregated list for a block of the given size.
+ * Sizes up to SMALLCLASSMAX get one list per 8-byte step and sizes up to
+ * MEDCLASSMAX one per 16 bytes. Sizes below TREECUTOFF are split four ways
+ * per power of 2, found with a single count-leading-zeros, and everything
+ * larger shares TREE_LIST.
+ */
+static inline int get_list_index(size_t size) {
+    int log;
+
+    if (size <= SMALLCLASSMAX)
+        return (size >> 3) - 2;
+    if (size <= MEDCLASSMAX)
+        return SMALLCLASSNUM + ((size - SMALLCLASSMAX - 1) >> 4);
+    if (size >= TREECUTOFF)
+        return TREE_LIST;
+
+    log = (int)(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size));
+    return SMALLCLASSNUM + MEDCLASSNUM + ((log - 9) << 2) + ((size >> (log - 2)) & 3);
 }
 
 /*
  * insert_node - Inserts a free block into the appropriate segregated list,
- * sorted by size in descending order.
+ * sorted by size in ascending order, or by address in the lists of
+ * lists_by_addr.
  */
 static void insert_node(void *ptr, size_t size) {
-    int list = 0;
+    int list = get_list_index(size);
     void *search_ptr;
     void *insert_ptr = NULL;
 
-    /* Find the appropriate class from the segregated list */
-    while ((list < SEGLISTNUM - 1) && (size > 1)) {
-        size >>= 1;
-        list++;
+    TOUCH_LIST(list);
+    if (list == TREE_LIST) {
+        tree_insert(ptr);
+        MARK_LIST(list);
+        STAT_WALK(insert);
+        return;
     }
 
-    /* Find insertion point (descending order by size) */
-    search_ptr = segregated_free_lists[list];
-    while ((search_ptr != NULL) && (size < GET_SIZE(HDRP(search_ptr)))) {
+    /* Find insertion point (ascending order by size or address) */
+    search_ptr = arena->segregated_free_lists[list];
+    while ((search_ptr != NULL) &&
+           ((lists_by_addr & LIST_BIT(list)) ? ((char *)ptr > (char *)search_ptr) :
+            (size > GET_SIZE(HDRP(search_ptr))))) {
+        STAT_STEP();
         insert_ptr = search_ptr;
         search_ptr = SUCC(search_ptr);
     }
+    STAT_WALK(insert);
 
     /* Insert block */
     if (search_ptr != NULL) {
         if (insert_ptr != NULL) { /* Middle */
-            *SUCC_PTR(ptr) = search_ptr;
-            *PRED_PTR(ptr) = insert_ptr;
-            *PRED_PTR(search_ptr) = ptr;
-            *SUCC_PTR(insert_ptr) = ptr;
+            SET_SUCC(ptr, search_ptr);
+            SET_PRED(ptr, insert_ptr);
+            SET_PRED(search_ptr, ptr);
+            SET_SUCC(insert_ptr, ptr);
         } else { /* Head */
-            *SUCC_PTR(ptr) = search_ptr;
-            *PRED_PTR(ptr) = NULL;
-            *PRED_PTR(search_ptr) = ptr;
-            segregated_free_lists[list] = ptr;
+            SET_SUCC(ptr, search_ptr);
+            SET_PRED(ptr, NULL);
+            SET_PRED(search_ptr, ptr);
+            arena->segregated_free_lists[list] = ptr;
         }
     } else {
         if (insert_ptr != NULL) { /* Tail */
-            *SUCC_PTR(ptr) = NULL;
-            *PRED_PTR(ptr) = insert_ptr;
-            *SUCC_PTR(insert_ptr) = ptr;
+            SET_SUCC(ptr, NULL);
+            SET_PRED(ptr, insert_ptr);
+            SET_SUCC(insert_ptr, ptr);
         } else { /* Empty list */
-            *SUCC_PTR(ptr) = NULL;
-            *PRED_PTR(ptr) = NULL;
-            segregated_free_lists[list] = ptr;
+            SET_SUCC(ptr, NULL);
+            SET_PRED(ptr, NULL);
+            arena->segregated_free_lists[list] = ptr;
+            MARK_LIST(list);
         }
     }
 }
 
 
 /*
- * delete_node - Removes a free block from its segregated list.
+ * delete_node - Removes a free block from its segregated list, moving the
+ * next-fit rover on to its successor if it pointed at the block.
  */
 static void delete_node(void *ptr) {
-    int list = 0;
-    size_t size = GET_SIZE(HDRP(ptr));
+    int list = get_list_index(GET_SIZE(HDRP(ptr)));
 
-    /* Find the appropriate class from the segregated list */
-    while ((list < SEGLISTNUM - 1) && (size > 1)) {
-        size >>= 1;
-        list++;
+    TOUCH_LIST(list);
+    if (list == TREE_LIST) {
+        tree_delete(ptr);
+        if (TREE_ROOT == NULL)
+            CLEAR_LIST(list);
+        return;
     }
+    if (ptr == arena->rover)
+        arena->rover = SUCC(ptr);
 
     /* Remove block */
     if (SUCC(ptr) != NULL) {
         if (PRED(ptr) != NULL) {
-            *SUCC_PTR(PRED(ptr)) = SUCC(ptr);
-            *PRED_PTR(SUCC(ptr)) = PRED(ptr);
+            SET_SUCC(PRED(ptr), SUCC(ptr));
+            SET_PRED(SUCC(ptr), PRED(ptr));
         } else {
-            *PRED_PTR(SUCC(ptr)) = NULL;
-            segregated_free_lists[list] = SUCC(ptr);
+            SET_PRED(SUCC(ptr), NULL);
+            arena->segregated_free_lists[list] = SUCC(ptr);
         }
     } else {
         if (PRED(ptr) != NULL) {
-            *SUCC_PTR(PRED(ptr)) = NULL;
+            SET_SUCC(PRED(ptr), NULL);
+        } else {
+            arena->segregated_free_lists[list] = NULL;
+            CLEAR_LIST(list);
+        }
+    }
+}
+
+/*
+ * tree_rotate_left - Rotates the subtree rooted at x to the left.
+ */
+static void tree_rotate_left(void *x) {
+    void *y = RIGHT(x);
+    void *parent = PARENT(x);
+
+    SET_RIGHT(x, LEFT(y));
+    if (LEFT(y) != NULL)
+        SET_PARENT(LEFT(y), x);
+
+    SET_PARENT(y, parent);
+    if (parent == NULL)
+        TREE_ROOT = y;
+    else if (x == LEFT(parent))
+        SET_LEFT(parent, y);
+    else
+        SET_RIGHT(parent, y);
+
+    SET_LEFT(y, x);
+    SET_PARENT(x, y);
+}
+
+/*
+ * tree_rotate_right - Rotates the subtree rooted at x to the right.
+ */
+static void tree_rotate_right(void *x) {
+    void *y = LEFT(x);
+    void *parent = PARENT(x);
+
+    SET_LEFT(x, RIGHT(y));
+    if (RIGHT(y) != NULL)
+        SET_PARENT(RIGHT(y), x);
+
+    SET_PARENT(y, parent);
+    if (parent == NULL)
+        TREE_ROOT = y;
+    else if (x == RIGHT(parent))
+        SET_RIGHT(parent, y);
+    else
+        SET_LEFT(parent, y);
+
+    SET_RIGHT(y, x);
+    SET_PARENT(x, y);
+}
+
+/*
+ * tree_insert - Inserts a large free block into the red-black tree.
+ * The block's header must already hold its size.
+ */
+static void tree_insert(void *ptr) {
+    void *parent = NULL;
+    void *node = TREE_ROOT;
+    void *gparent, *uncle;
+
+    /* Ordinary BST insert */
+    while (node != NULL) {
+        STAT_STEP();
+        parent = node;
+        node = TREE_LESS(ptr, node) ? LEFT(node) : RIGHT(node);
+    }
+
+    SET_LEFT(ptr, NULL);
+    SET_RIGHT(ptr, NULL);
+    SET_PARENT(ptr, parent);
+    SET_COLOR(ptr, RED);
+
+    if (parent == NULL)
+        TREE_ROOT = ptr;
+    else if (TREE_LESS(ptr, parent))
+        SET_LEFT(parent, ptr);
+    else
+        SET_RIGHT(parent, ptr);
+
+    /* Restore the red-black properties */
+    node = ptr;
+    while ((parent = PARENT(node)) != NULL && IS_RED(parent)) {
+        gparent = PARENT(parent);
+        if (parent == LEFT(gparent)) {
+            uncle = RIGHT(gparent);
+            if (IS_RED(uncle)) {        /* Case 1: recolor and move up */
+                SET_COLOR(uncle, BLACK);
+                SET_COLOR(parent, BLACK);
+                SET_COLOR(gparent, RED);
+                node = gparent;
+                continue;
+            }
+            if (node == RIGHT(parent)) { /* Case 2: turn into case 3 */
+                tree_rotate_left(parent);
+                node = parent;
+                parent = PARENT(node);
+            }
+            SET_COLOR(parent, BLACK);    /* Case 3: rotate grandparent */
+            SET_COLOR(gparent, RED);
+            tree_rotate_right(gparent);
+        } else {
+            uncle = LEFT(gparent);
+            if (IS_RED(uncle)) {
+                SET_COLOR(uncle, BLACK);
+                SET_COLOR(parent, BLACK);
+                SET_COLOR(gparent, RED);
+                node = gparent;
+                continue;
+            }
+            if (node == LEFT(parent)) {
+                tree_rotate_right(parent);
+                node = parent;
+                parent = PARENT(node);
+            }
+            SET_COLOR(parent, BLACK);
+            SET_COLOR(gparent, RED);
+            tree_rotate_left(gparent);
+        }
+    }
+    SET_COLOR(TREE_ROOT, BLACK);
+}
+
+/*
+ * tree_transplant - Replaces the subtree rooted at u with the one rooted at v.
+ */
+static void tree_transplant(void *u, void *v) {
+    void *parent = PARENT(u);
+
+    if (parent == NULL)
+        TREE_ROOT = v;
+    else if (u == LEFT(parent))
+        SET_LEFT(parent, v);
+    else
+        SET_RIGHT(parent, v);
+
+    if (v != NULL)
+        SET_PARENT(v, parent);
+}
+
+/*
+ * tree_delete - Removes a large free block from the red-black tree.
+ */
+static void tree_delete(void *ptr) {
+    void *y = ptr;
+    void *x, *x_parent, *w;
+    unsigned int y_color = COLOR(y);
+
+    if (LEFT(ptr) == NULL) {
+        x = RIGHT(ptr);
+        x_parent = PARENT(ptr);
+        tree_transplant(ptr, x);
+    } else if (RIGHT(ptr) == NULL) {
+        x = LEFT(ptr);
+        x_parent = PARENT(ptr);
+        tree_transplant(ptr, x);
+    } else {
+        /* Splice out the in-order successor and put it in ptr's place */
+        y = RIGHT(ptr);
+        while (LEFT(y) != NULL)
+            y = LEFT(y);
+        y_color = COLOR(y);
+        x = RIGHT(y);
+
+        if (PARENT(y) == ptr) {
+            x_parent = y;
+        } else {
+            x_parent = PARENT(y);
+            tree_transplant(y, x);
+            SET_RIGHT(y, RIGHT(ptr));
+            SET_PARENT(RIGHT(y), y);
+        }
+        tree_transplant(ptr, y);
+        SET_LEFT(y, LEFT(ptr));
+        SET_PARENT(LEFT(y), y);
+        SET_COLOR(y, COLOR(ptr));
+    }
+
+    if (y_color == RED)
+        return;
+
+    /* A black node was removed: push the extra black up or fix it here */
+    while (x != TREE_ROOT && !IS_RED(x)) {
+        if (x == LEFT(x_parent)) {
+            w = RIGHT(x_parent);
+            if (IS_RED(w)) {
+                SET_COLOR(w, BLACK);
+                SET_COLOR(x_parent, RED);
+                tree_rotate_left(x_parent);
+                w = RIGHT(x_parent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                SET_COLOR(w, RED);
+                x = x_parent;
+                x_parent = PARENT(x);
+            } else {
+                if (!IS_RED(RIGHT(w))) {
+                    SET_COLOR(LEFT(w), BLACK);
+                    SET_COLOR(w, RED);
+                    tree_rotate_right(w);
+                    w = RIGHT(x_parent);
+                }
+                SET_COLOR(w, COLOR(x_parent));
+                SET_COLOR(x_parent, BLACK);
+                SET_COLOR(RIGHT(w), BLACK);
+                tree_rotate_left(x_parent);
+                x = TREE_ROOT;
+            }
         } else {
-            segregated_free_lists[list] = NULL;
+            w = LEFT(x_parent);
+            if (IS_RED(w)) {
+                SET_COLOR(w, BLACK);
+                SET_COLOR(x_parent, RED);
+                tree_rotate_right(x_parent);
+                w = LEFT(x_parent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                SET_COLOR(w, RED);
+                x = x_parent;
+                x_parent = PARENT(x);
+            } else {
+                if (!IS_RED(LEFT(w))) {
+                    SET_COLOR(RIGHT(w), BLACK);
+                    SET_COLOR(w, RED);
+                    tree_rotate_left(w);
+                    w = LEFT(x_parent);
+                }
+                SET_COLOR(w, COLOR(x_parent));
+                SET_COLOR(x_parent, BLACK);
+                SET_COLOR(LEFT(w), BLACK);
+                tree_rotate_right(x_parent);
+                x = TREE_ROOT;
+            }
+        }
+    }
+    if (x != NULL)
+        SET_COLOR(x, BLACK);
+}
+
+/*
+ * tree_successor - Returns the next block in tree order, or NULL.
+ */
+static void *tree_successor(void *node) {
+    void *parent;
+
+    if (RIGHT(node) != NULL) {
+        node = RIGHT(node);
+        while (LEFT(node) != NULL)
+            node = LEFT(node);
+        return node;
+    }
+
+    parent = PARENT(node);
+    while (parent != NULL && node == RIGHT(parent)) {
+        node = parent;
+        parent = PARENT(node);
+    }
+    return parent;
+}
+
+/*
+ * tree_find_fit - Returns the smallest block of at least asize bytes that
+ * does not carry a reallocation tag, or NULL.
+ */
+static void *tree_find_fit(size_t asize) {
+    void *node = TREE_ROOT;
+    void *fit = NULL;
+
+    while (node != NULL) {
+        STAT_STEP();
+        if (GET_SIZE(HDRP(node)) >= asize) {
+            fit = node;
+            node = LEFT(node);
+        } else {
+            node = RIGHT(node);
         }
     }
+
+    while ((fit != NULL) && GET_REALLOC(HDRP(fit))) {
+        STAT_STEP();
+        STAT_ADD(tag_skips, 1);
+        fit = tree_successor(fit);
+    }
+    return fit;
 }
 
 /*
- * coalesce - Coalesces adjacent free blocks.
+ * coalesce - Coalesces a free block that is not yet in any list with its
+ * free neighbours and inserts the result into the segregated list.
  */
 static void *coalesce(void *ptr) {
-    unsigned int prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(ptr)));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
     unsigned int next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
     size_t size = GET_SIZE(HDRP(ptr));
 
     if (prev_alloc && next_alloc) {                 /* Case 1: The previous block and the next block are both allocated */
-        return ptr;
+        /* Nothing to merge */
     } else if (prev_alloc && !next_alloc) {         /* Case 2: The next block is free */
-        delete_node(ptr);
         delete_node(NEXT_BLKP(ptr));
         size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-        PUT(HDRP(ptr), PACK(size, 0));
+        PUT(HDRP(ptr), PACK(size, PREV_ALLOC));
         PUT(FTRP(ptr), PACK(size, 0));
     } else if (!prev_alloc && next_alloc) {         /* Case 3: The previous block is free */
-        delete_node(ptr);
         delete_node(PREV_BLKP(ptr));
         size += GET_SIZE(HDRP(PREV_BLKP(ptr)));
         ptr = PREV_BLKP(ptr);
-        PUT(HDRP(ptr), PACK(size, 0));
+        PUT(HDRP(ptr), PACK(size, GET_PREV_ALLOC(HDRP(ptr))));
         PUT(FTRP(ptr), PACK(size, 0));
     } else {                                        /* Case 4: The previous block and the next block are both free */
-        delete_node(ptr);
         delete_node(PREV_BLKP(ptr));
         delete_node(NEXT_BLKP(ptr));
         size += GET_SIZE(HDRP(PREV_BLKP(ptr))) + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
         ptr = PREV_BLKP(ptr);
-        PUT(HDRP(ptr), PACK(size, 0));
+        PUT(HDRP(ptr), PACK(size, GET_PREV_ALLOC(HDRP(ptr))));
         PUT(FTRP(ptr), PACK(size, 0));
     }
-    
+    if (!prev_alloc || !next_alloc)
+        STAT_CLASS(size, coalesces, 1);
+
+    /* The last allocation may have been freed into this block */
+    if ((unsigned long)(arena->last_alloc - (char *)ptr) < size)
+        arena->last_alloc = NULL;
+
     insert_node(ptr, size);
     return ptr;
 }
@@ -297,28 +1143,38 @@ static void *coalesce(void *ptr) {
  * Implements a back-placement strategy for larger blocks to reduce external fragmentation.
  */
 static void *place(void *ptr, size_t asize) {
+    return place_at(ptr, asize, asize >= opts.back_place_min);
+}
+
+/*
+ * place_at - Places a block of a given size at the end of the free block
+ * if back is set, and at its start otherwise.
+ */
+static void *place_at(void *ptr, size_t asize, int back) {
     size_t ptr_size = GET_SIZE(HDRP(ptr));
     size_t remainder = ptr_size - asize;
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
 
     delete_node(ptr);
+    if (remainder >= opts.split_min)
+        STAT_CLASS(ptr_size, splits, 1);
 
-    if (remainder <= (DSIZE << 1)) {
+    if (remainder < opts.split_min) {
         /* If the remainder is too small, don't split. */
-        PUT_REALLOC(HDRP(ptr), PACK(ptr_size, 1));
-        PUT_REALLOC(FTRP(ptr), PACK(ptr_size, 1));
-    } else if (asize >= 100) { 
+        PUT_REALLOC(HDRP(ptr), PACK(ptr_size, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+    } else if (back) { 
         /* Back-placement for larger blocks */
-        PUT_NO_REALLOC(HDRP(ptr), PACK(remainder, 0));
+        PUT_NO_REALLOC(HDRP(ptr), PACK(remainder, prev_alloc));
         PUT_NO_REALLOC(FTRP(ptr), PACK(remainder, 0));
         PUT_NO_REALLOC(HDRP(NEXT_BLKP(ptr)), PACK(asize, 1));
-        PUT_NO_REALLOC(FTRP(NEXT_BLKP(ptr)), PACK(asize, 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(NEXT_BLKP(ptr))));
         insert_node(ptr, remainder);
         return NEXT_BLKP(ptr);
     } else { 
         /* Front-placement */
-        PUT_REALLOC(HDRP(ptr), PACK(asize, 1));
-        PUT_REALLOC(FTRP(ptr), PACK(asize, 1));
-        PUT_NO_REALLOC(HDRP(NEXT_BLKP(ptr)), PACK(remainder, 0));
+        PUT_REALLOC(HDRP(ptr), PACK(asize, prev_alloc | 1));
+        PUT_NO_REALLOC(HDRP(NEXT_BLKP(ptr)), PACK(remainder, PREV_ALLOC));
         PUT_NO_REALLOC(FTRP(NEXT_BLKP(ptr)), PACK(remainder, 0));
         insert_node(NEXT_BLKP(ptr), remainder);
     }
@@ -326,120 +1182,1436 @@ static void *place(void *ptr, size_t asize) {
 }
 
 /*
- * mm_malloc - Allocates a memory block.
+ * place_batch - Carves up to n blocks of asize bytes from the start of a
+ * free block into out, and returns how many it carved. A tail smaller than
+ * the split_min option is absorbed by the last block, as in place_at.
  */
-void *mm_malloc(size_t size) {
-    size_t asize;
-    size_t extendsize;
-    void *ptr = NULL;
-    int list = 0;
-
-    if (size == 0)
-        return NULL;
+static size_t place_batch(void *ptr, size_t asize, size_t n, void **out) {
+    size_t ptr_size = GET_SIZE(HDRP(ptr));
+    size_t count = MIN(n, ptr_size / asize);
+    size_t remainder = ptr_size - count * asize;
+    size_t bsize = asize;
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+    char *bp = ptr;
+    size_t i;
 
-    if (size <= DSIZE) {
-        asize = DSIZE << 1;
-    } else {
-        asize = ALIGN(size + DSIZE);
-    }
+    delete_node(ptr);
+    if ((count > 1) || (remainder >= opts.split_min))
+        STAT_CLASS(ptr_size, splits, 1);
 
-    size_t searchsize = asize;
-    while (list < SEGLISTNUM) {
-        if ((list == SEGLISTNUM - 1) || ((searchsize <= 1) && (segregated_free_lists[list] != NULL))) {
-            ptr = segregated_free_lists[list];
-            while ((ptr != NULL) && ((asize > GET_SIZE(HDRP(ptr))) || (GET_REALLOC(HDRP(ptr))))) {
-                ptr = SUCC(ptr);
-            }
-            if (ptr != NULL)
-                break;
-        }
-        searchsize >>= 1;
-        list++;
+    for (i = 0; i < count; i++) {
+        if ((i == count - 1) && (remainder < opts.split_min))
+            bsize += remainder;
+        PUT_NO_REALLOC(HDRP(bp), PACK(bsize, prev_alloc | 1));
+        prev_alloc = PREV_ALLOC;
+        out[i] = bp;
+        bp += bsize;
     }
 
-    if (ptr == NULL) {
-        extendsize = MAX(asize, CHUNKSIZE);
-        if ((ptr = extend_heap(extendsize)) == NULL)
-            return NULL;
+    if (remainder >= opts.split_min) {
+        PUT_NO_REALLOC(HDRP(bp), PACK(remainder, PREV_ALLOC));
+        PUT_NO_REALLOC(FTRP(bp), PACK(remainder, 0));
+        insert_node(bp, remainder);
+    } else {
+        SET_PREV_ALLOC(HDRP(bp));
     }
-
-    ptr = place(ptr, asize);
-    return ptr;
+    return count;
 }
 
 /*
- * mm_free - Frees a memory block.
+ * slab_link - Pushes a run onto the list of runs with free slots.
  */
-void mm_free(void *ptr) {
-    if (ptr == NULL)
-        return;
+static void slab_link(int class, void *run) {
+    SET_RUN_PREV(run, NULL);
+    SET_RUN_NEXT(run, arena->slab_runs[class]);
+    if (arena->slab_runs[class] != NULL)
+        SET_RUN_PREV(arena->slab_runs[class], run);
+    arena->slab_runs[class] = run;
+}
 
-    size_t size = GET_SIZE(HDRP(ptr));
-    REMOVE_REALLOC(HDRP(NEXT_BLKP(ptr)));
-    
-    PUT(HDRP(ptr), PACK(size, 0));
-    PUT(FTRP(ptr), PACK(size, 0));
-    
-    insert_node(ptr, size);
-    coalesce(ptr);
+/*
+ * slab_unlink - Removes a run from the list of runs with free slots.
+ */
+static void slab_unlink(int class, void *run) {
+    if (RUN_PREV(run) != NULL)
+        SET_RUN_NEXT(RUN_PREV(run), RUN_NEXT(run));
+    else
+        arena->slab_runs[class] = RUN_NEXT(run);
+    if (RUN_NEXT(run) != NULL)
+        SET_RUN_PREV(RUN_NEXT(run), RUN_PREV(run));
 }
 
 /*
- * mm_realloc - Reallocates a memory block with advanced heuristics.
+ * place_aligned - Allocates asize bytes at bp, which must lie inside the
+ * free block ptr. The leading and trailing parts are returned to the free
+ * lists; a trailing part too small to be a block is absorbed.
  */
-void *mm_realloc(void *ptr, size_t size) {
-    if (ptr == NULL)
-        return mm_malloc(size);
-    if (size == 0) {
-        mm_free(ptr);
-        return NULL;
-    }
+static void *place_aligned(void *ptr, char *bp, size_t asize) {
+    size_t ptr_size = GET_SIZE(HDRP(ptr));
+    size_t lead = bp - (char *)ptr;
+    size_t trail = ptr_size - lead - asize;
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
 
-    void *new_ptr = ptr;
-    size_t new_size = ALIGN(size + DSIZE);
-    size_t old_size = GET_SIZE(HDRP(ptr));
-    int remainder;
+    delete_node(ptr);
+    if ((lead != 0) || (trail >= MINBLOCKSIZE))
+        STAT_CLASS(ptr_size, splits, 1);
 
-    /* Add buffer for future reallocations */
-    if (new_size < old_size) {
-        remainder = old_size - new_size;
-        if (remainder < (DSIZE << 1)) {
-             PUT(HDRP(ptr), PACK(old_size, 1));
-             PUT(FTRP(ptr), PACK(old_size, 1));
-             SET_REALLOC(HDRP(NEXT_BLKP(ptr)));
-        }
-        return ptr;
+    if (lead != 0) {
+        PUT_NO_REALLOC(HDRP(ptr), PACK(lead, prev_alloc));
+        PUT_NO_REALLOC(FTRP(ptr), PACK(lead, 0));
+        insert_node(ptr, lead);
+        prev_alloc = 0;
     }
-    
-    int block_buffer = GET_SIZE(HDRP(ptr)) - new_size;
-
-    /* Allocate more space if needed */
-    if (block_buffer < 0) {
-        /* Check if next block is free or the end of the heap */
-        if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr))) || !GET_SIZE(HDRP(NEXT_BLKP(ptr)))) {
-            remainder = old_size + GET_SIZE(HDRP(NEXT_BLKP(ptr))) - new_size;
-            if (remainder < 0) {
-                size_t extendsize = MAX(-remainder, CHUNKSIZE);
-                if (extend_heap(extendsize) == NULL)
-                    return NULL;
-                remainder += extendsize;
-            }
-            
-            delete_node(NEXT_BLKP(ptr));
-            PUT_NO_REALLOC(HDRP(ptr), PACK(new_size + remainder, 1));
-            PUT_NO_REALLOC(FTRP(ptr), PACK(new_size + remainder, 1));
 
-        } else { /* Fallback to malloc and free */
-            new_ptr = mm_malloc(new_size - DSIZE);
-            memcpy(new_ptr, ptr, MIN(size, new_size) - DSIZE);
-            mm_free(ptr);
-        }
-        block_buffer = GET_SIZE(HDRP(new_ptr)) - new_size;
+    if (trail < MINBLOCKSIZE) {
+        PUT_NO_REALLOC(HDRP(bp), PACK(asize + trail, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    } else {
+        PUT_NO_REALLOC(HDRP(bp), PACK(asize, prev_alloc | 1));
+        PUT_NO_REALLOC(HDRP(NEXT_BLKP(bp)), PACK(trail, PREV_ALLOC));
+        PUT_NO_REALLOC(FTRP(NEXT_BLKP(bp)), PACK(trail, 0));
+        insert_node(NEXT_BLKP(bp), trail);
     }
+    return bp;
+}
 
-    /* Tag the next block if the buffer is small */
-    if (block_buffer < (REALLOC_BUFFER << 1))
-        SET_REALLOC(HDRP(NEXT_BLKP(new_ptr)));
+/*
+ * slab_new_run - Carves a fresh page-aligned run for a class out of the
+ * free block at the top of the arena's heap, extending the heap first if
+ * that block cannot hold an aligned run.
+ */
+static void *slab_new_run(int class) {
+    char *end, *top, *run;
+    size_t top_size;
+    size_t objsize = SLAB_OBJSIZE(class);
+    unsigned int nobj = RUN_NOBJ(objsize);
+    unsigned long long *map;
+    int i;
 
+    /* Retried if the extension had to start a new segment */
+    for (;;) {
+        end = arena->heap_end;
+        top = end;
+        top_size = 0;
+
+        /* The epilogue's prev_alloc bit tells whether the top block is free */
+        if (!GET_PREV_ALLOC(HDRP(end))) {
+            top_size = GET_SIZE(end - DSIZE);
+            top = end - top_size;
+        }
+
+        /* First run boundary that leaves either no gap or a whole free block */
+        run = heap_base + (((top - heap_base) + RUNSIZE - 1) & ~(RUNSIZE - 1));
+        if ((run != top) && (run - top < MINBLOCKSIZE))
+            run += RUNSIZE;
+
+        if (run + RUNSIZE <= top + top_size)
+            break;
+        if (extend_heap(MAX(run + RUNSIZE - (top + top_size), MINBLOCKSIZE)) == NULL)
+            return NULL;
+    }
+    place_aligned(top, run, RUNSIZE);
+
+    /* To the main heap a run is just an allocated block */
+    PUT(run, objsize);
+    SET_RUN_NFREE(run, nobj);
+    map = RUN_MAP(run);
+    for (i = 0; i < RUNMAPWORDS; i++) {
+        if (nobj >= 64) {
+            map[i] = ~0ULL;
+            nobj -= 64;
+        } else {
+            map[i] = (1ULL << nobj) - 1;
+            nobj = 0;
+        }
+    }
+
+    MARK_SLAB(run);
+    slab_link(class, run);
+    return run;
+}
+
+/*
+ * slab_alloc - Returns a free slot from the first run of the request's
+ * class, creating a new run if the class has none.
+ */
+static void *slab_alloc(size_t size) {
+    int class = SLAB_CLASS(size);
+    void *run = arena->slab_runs[class];
+    unsigned long long *map;
+    unsigned int nfree;
+    int i, slot;
+
+    if ((run == NULL) && ((run = slab_new_run(class)) == NULL))
+        return NULL;
+
+    map = RUN_MAP(run);
+    for (i = 0; map[i] == 0; i++)
+        ;
+    slot = (i << 6) + __builtin_ctzll(map[i]);
+    map[i] &= map[i] - 1;
+
+    nfree = RUN_NFREE(run) - 1;
+    SET_RUN_NFREE(run, nfree);
+    if (nfree == 0)
+        slab_unlink(class, run);
+
+    return RUN_OBJS(run) + slot * RUN_OBJSIZE(run);
+}
+
+/*
+ * slab_free - Marks a slot free. A run that becomes empty goes back to the
+ * main heap unless it is the only run of its class with free slots.
+ */
+static void slab_free(void *ptr) {
+    char *run = RUN_OF(ptr);
+    size_t objsize = RUN_OBJSIZE(run);
+    int class = SLAB_CLASS(objsize);
+    unsigned int slot = ((char *)ptr - RUN_OBJS(run)) / objsize;
+    unsigned int nfree = RUN_NFREE(run) + 1;
+
+    STAT_CLASS(MAX(ALIGN(objsize + WSIZE), MINBLOCKSIZE), frees, 1);
+    RUN_MAP(run)[slot >> 6] |= 1ULL << (slot & 63);
+    SET_RUN_NFREE(run, nfree);
+
+    if (nfree == 1) {
+        slab_link(class, run);
+    } else if ((nfree == RUN_NOBJ(objsize)) &&
+               ((arena->slab_runs[class] != run) || (RUN_NEXT(run) != NULL))) {
+        slab_unlink(class, run);
+        CLEAR_SLAB(run);
+        free_block(run);
+    }
+}
+
+/*
+ * map_alloc - Maps a region for a huge request and lays down the mapping
+ * length and header ahead of the payload. A payload aligned beyond what
+ * MAPHDRSIZE gives starts as far into the mapping as it must.
+ */
+static void *map_alloc(size_t size, size_t alignment) {
+    size_t extra = MAX(alignment, MAPHDRSIZE) - MAPHDRSIZE;
+    size_t len;
+    char *base, *bp;
+
+    /* MAP_LENGTH would wrap around for a size this close to SIZE_MAX */
+    if (size > (size_t)-1 - extra - MAPHDRSIZE - mem_pagesize())
+        return NULL;
+    len = MAP_LENGTH(size + extra);
+    if ((base = mem_map(len)) == NULL)
+        return NULL;
+    bp = (char *)(((unsigned long)base + MAPHDRSIZE + alignment - 1) & ~(alignment - 1));
+    *(size_t *)(bp - MAPHDRSIZE) = len;
+    PUT_NO_REALLOC(bp - DSIZE, bp - MAPHDRSIZE - base);
+    PUT_NO_REALLOC(bp - WSIZE, MAPPED_HDR);
+    return bp;
+}
+
+/*
+ * heap_exhausted - Serves a request that fits no free block once the break
+ * cannot grow any further, from a mapping of its own. mm_free, mm_realloc
+ * and mm_usable_size already tell such a block by its address.
+ */
+static void *heap_exhausted(size_t size, size_t alignment) {
+    if (size <= SLABMAX)
+        arena->slab_live--;
+    return map_alloc(size, alignment);
+}
+
+/*
+ * map_realloc - Resizes a mapped block in place or by moving the mapping.
+ * A block shrunk below MMAPTHRESHOLD moves back into the heap.
+ */
+static void *map_realloc(void *ptr, size_t size) {
+    size_t pad = MAP_PAD(ptr);
+    size_t len;
+    char *base;
+    void *new_ptr;
+
+    if (size > (size_t)-1 - pad - MAPHDRSIZE - mem_pagesize())
+        return NULL;
+    len = MAP_LENGTH(size + pad);
+    if (size < MMAPTHRESHOLD) {
+        if ((new_ptr = mm_malloc(size)) == NULL)
+            return NULL;
+        memcpy(new_ptr, ptr, MIN(size, mm_usable_size(ptr)));
+        mem_unmap(MAP_BASE(ptr));
+        return new_ptr;
+    }
+    if (len == MAP_LEN(ptr))
+        return ptr;
+    if ((base = mem_remap(MAP_BASE(ptr), len)) == NULL)
+        return NULL;
+    *(size_t *)(base + pad) = len;
+    return base + pad + MAPHDRSIZE;
+}
+
+/*
+ * list_fit - Returns the first untagged block of at least asize bytes in
+ * a free list from ptr up to stop, or NULL. Under MM_FIT_GOOD only the
+ * first fit_candidates nodes are visited.
+ */
+static void *list_fit(void *ptr, void *stop, size_t asize) {
+    unsigned int budget = (opts.fit == MM_FIT_GOOD) ? opts.fit_candidates : ~0U;
+
+    while ((ptr != stop) && ((asize > GET_SIZE(HDRP(ptr))) || (GET_REALLOC(HDRP(ptr))))) {
+        STAT_STEP();
+        STAT_ADD(tag_skips, asize <= GET_SIZE(HDRP(ptr)));
+        if (--budget == 0)
+            return NULL;
+        ptr = SUCC(ptr);
+    }
+    return (ptr == stop) ? NULL : ptr;
+}
+
+/*
+ * find_fit - Returns an untagged free block of at least asize bytes, as
+ * the placement policy picks it, visiting only the non-empty lists at or
+ * above the request's class. A next-fit search of the rover's list starts
+ * at the rover and wraps around.
+ */
+static void *find_fit(size_t asize) {
+    unsigned long long candidates;
+    void *ptr = NULL;
+    void *head, *rover = arena->rover;
+    int list;
+
+    candidates = arena->seglist_bitmap & ~(LIST_BIT(get_list_index(asize)) - 1);
+    while (candidates) {
+        list = __builtin_ctzll(candidates);
+        if (list == TREE_LIST) {
+            ptr = tree_find_fit(asize);
+            break;
+        }
+        head = arena->segregated_free_lists[list];
+        if ((opts.fit == MM_FIT_NEXT) && (rover != NULL) &&
+            (get_list_index(GET_SIZE(HDRP(rover))) == list)) {
+            if ((ptr = list_fit(rover, NULL, asize)) == NULL)
+                ptr = list_fit(head, rover, asize);
+        } else {
+            ptr = list_fit(head, NULL, asize);
+        }
+        if (ptr != NULL) {
+            if (opts.fit == MM_FIT_NEXT)
+                arena->rover = ptr;
+            break;
+        }
+        candidates &= candidates - 1;
+    }
+    STAT_WALK(fit);
+    return ptr;
+}
+
+/*
+ * adjacent_fit - Returns a free neighbour of the block mm_malloc handed out
+ * last that holds asize bytes and is in the class find_fit would search
+ * first, or NULL. back says which end of it touches that block. Requests
+ * for the tree are left to its best fit.
+ */
+static void *adjacent_fit(size_t asize, int *back) {
+    char *last = arena->last_alloc;
+    unsigned long long candidates;
+    int first;
+    void *ptr;
+
+    if ((last == NULL) || ((first = get_list_index(asize)) == TREE_LIST))
+        return NULL;
+    if ((candidates = arena->seglist_bitmap & ~(LIST_BIT(first) - 1)) == 0)
+        return NULL;
+    first = __builtin_ctzll(candidates);
+
+    ptr = NEXT_BLKP(last);
+    *back = 0;
+    if (GET_ALLOC(HDRP(ptr))) {
+        if (GET_PREV_ALLOC(HDRP(last)))
+            return NULL;
+        ptr = PREV_BLKP(last);
+        *back = 1;
+    }
+    if ((GET_SIZE(HDRP(ptr)) < asize) || GET_REALLOC(HDRP(ptr)) ||
+        (get_list_index(GET_SIZE(HDRP(ptr))) > first))
+        return NULL;
+    return ptr;
+}
+
+/*
+ * align_point - Returns the first payload address in the free block ptr
+ * that is a multiple of alignment and leaves either no gap or a whole
+ * free block ahead of it.
+ */
+static char *align_point(void *ptr, size_t alignment) {
+    char *bp = (char *)(((unsigned long)ptr + alignment - 1) & ~(alignment - 1));
+
+    if ((bp != ptr) && (bp - (char *)ptr < MINBLOCKSIZE))
+        bp += alignment;
+    return bp;
+}
+
+/*
+ * aligned_fit - Returns the first untagged free block, in the request's
+ * class and up, that holds asize bytes from its aligned point on. The
+ * tree is keyed on size alone, so if its best fit does not align it is
+ * asked for a block big enough for any aligned point.
+ */
+static void *aligned_fit(size_t asize, size_t alignment) {
+    unsigned long long candidates;
+    void *ptr = NULL;
+    int list;
+
+    candidates = arena->seglist_bitmap & ~(LIST_BIT(get_list_index(asize)) - 1);
+    while (candidates) {
+        list = __builtin_ctzll(candidates);
+        if (list == TREE_LIST) {
+            ptr = tree_find_fit(asize);
+            if ((ptr != NULL) &&
+                (align_point(ptr, alignment) + asize > (char *)ptr + GET_SIZE(HDRP(ptr))))
+                ptr = tree_find_fit(asize + alignment + MINBLOCKSIZE);
+            break;
+        }
+        for (ptr = arena->segregated_free_lists[list]; ptr != NULL; ptr = SUCC(ptr)) {
+            STAT_STEP();
+            if (!GET_REALLOC(HDRP(ptr)) &&
+                (align_point(ptr, alignment) + asize <= (char *)ptr + GET_SIZE(HDRP(ptr))))
+                break;
+        }
+        if (ptr != NULL)
+            break;
+        candidates &= candidates - 1;
+    }
+    STAT_WALK(fit);
+    return ptr;
+}
+
+/*
+ * quick_flush - Releases every block cached in quick list q.
+ */
+static void quick_flush(int q) {
+    void *ptr;
+
+    TOUCH_QUICK(q);
+    while ((ptr = arena->quick_lists[q]) != NULL) {
+        arena->quick_lists[q] = SUCC(ptr);
+        free_block(ptr);
+    }
+    arena->quick_total -= arena->quick_counts[q];
+    arena->quick_counts[q] = 0;
+}
+
+/*
+ * mm_malloc - Allocates a memory block.
+ */
+void *mm_malloc(size_t size) {
+    void *ptr = malloc_block(size);
+
+    CHECK_HEAP(ptr);
+    return ptr;
+}
+
+/*
+ * malloc_block - Allocates a memory block for mm_malloc.
+ */
+static void *malloc_block(size_t size) {
+    size_t asize;
+    size_t extendsize;
+    void *ptr;
+    int q, back;
+
+    if (size == 0)
+        return NULL;
+    if (size >= MMAPTHRESHOLD)
+        return map_alloc(size, ALIGNMENT);
+    if (!ARENA_READY())
+        return NULL;
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != 0)
+        arena_drain();
+
+    asize = MAX(ALIGN(size + WSIZE), MINBLOCKSIZE);
+    STAT_CLASS(asize, allocs, 1);
+
+    if (size <= SLABMAX) {
+        if (arena->slab_live >= SLABMINLIVE)
+            return ((ptr = slab_alloc(size)) != NULL) ? ptr : map_alloc(size, ALIGNMENT);
+        arena->slab_live++;
+    }
+
+    /* Reuse a recently freed block of exactly this size */
+    if ((asize <= QUICKMAX) && ((ptr = arena->quick_lists[q = QUICK_INDEX(asize)]) != NULL)) {
+        arena->quick_lists[q] = SUCC(ptr);
+        arena->quick_counts[q]--;
+        arena->quick_total--;
+        TOUCH_QUICK(q);
+        return arena->last_alloc = ptr;
+    }
+
+    /* Carve the block from a free neighbour of the last one, if one fits */
+    if (opts.prefer_adjacent && ((ptr = adjacent_fit(asize, &back)) != NULL))
+        return arena->last_alloc = place_at(ptr, asize, back);
+
+    /* On a miss, coalesce the deferred blocks before growing the heap */
+    if (((ptr = find_fit(asize)) == NULL) && (arena->quick_total > 0)) {
+        for (q = 0; q < QUICKLISTNUM; q++)
+            quick_flush(q);
+        ptr = find_fit(asize);
+    }
+
+    if (ptr == NULL) {
+        extendsize = MAX(asize, opts.chunk_size);
+        if ((ptr = extend_heap(extendsize)) == NULL)
+            return heap_exhausted(size, ALIGNMENT);
+    }
+
+    ptr = place(ptr, asize);
+    return arena->last_alloc = ptr;
+}
+
+/*
+ * mm_memalign - Allocates a memory block whose payload address is a
+ * multiple of alignment, a power of 2 no larger than MAPALIGNMAX. The
+ * block is carved at an aligned point of a free block, and the slack
+ * ahead of it stays free.
+ */
+void *mm_memalign(size_t alignment, size_t size) {
+    void *ptr = memalign_block(alignment, size);
+
+    CHECK_HEAP(ptr);
+    return ptr;
+}
+
+/*
+ * memalign_block - Allocates an aligned memory block for mm_memalign.
+ */
+static void *memalign_block(size_t alignment, size_t size) {
+    size_t asize;
+    size_t extendsize;
+    void *ptr;
+    int q;
+
+    if ((alignment == 0) || (alignment & (alignment - 1)) || (alignment > MAPALIGNMAX))
+        return NULL;
+    if (alignment <= ALIGNMENT)
+        return malloc_block(size);
+    if ((size == 0) || (size > (size_t)-1 - alignment - mem_pagesize()))
+        return NULL;
+    if ((size >= MMAPTHRESHOLD) || (alignment >= MMAPTHRESHOLD))
+        return map_alloc(size, alignment);
+    if (!ARENA_READY())
+        return NULL;
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != 0)
+        arena_drain();
+
+    asize = MAX(ALIGN(size + WSIZE), MINBLOCKSIZE);
+    STAT_CLASS(asize, allocs, 1);
+
+    /* Runs and quick lists take no account of alignment, so neither is used */
+    if (size <= SLABMAX)
+        arena->slab_live++;
+
+    if (((ptr = aligned_fit(asize, alignment)) == NULL) && (arena->quick_total > 0)) {
+        for (q = 0; q < QUICKLISTNUM; q++)
+            quick_flush(q);
+        ptr = aligned_fit(asize, alignment);
+    }
+
+    /* An extension this large holds the block whatever its aligned point */
+    if (ptr == NULL) {
+        extendsize = MAX(asize + alignment + MINBLOCKSIZE, opts.chunk_size);
+        if ((ptr = extend_heap(extendsize)) == NULL)
+            return heap_exhausted(size, alignment);
+    }
+
+    return place_aligned(ptr, align_point(ptr, alignment), asize);
+}
+
+/*
+ * mm_malloc_batch - Allocates n blocks of size bytes each into out. Returns
+ * the number allocated, which is less than n only if memory ran out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t asize, count, got = 0;
+    void *ptr;
+    int q;
+
+    if ((size == 0) || !ARENA_READY())
+        return 0;
+
+    /* Slab objects and mapped blocks are already handed out one at a time */
+    if ((size <= SLABMAX) || (size >= MMAPTHRESHOLD)) {
+        while ((got < n) && ((out[got] = mm_malloc(size)) != NULL))
+            got++;
+        return got;
+    }
+
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) != 0)
+        arena_drain();
+
+    asize = MAX(ALIGN(size + WSIZE), MINBLOCKSIZE);
+    while (got < n) {
+        count = MIN(n - got, MAX(BATCHSPANMAX / asize, 1));
+
+        /* A block for the whole batch, or else the best block for one */
+        if (((ptr = find_fit(asize * count)) == NULL) && ((ptr = find_fit(asize)) == NULL) &&
+            (arena->quick_total > 0)) {
+            for (q = 0; q < QUICKLISTNUM; q++)
+                quick_flush(q);
+            ptr = find_fit(asize);
+        }
+        if ((ptr == NULL) && ((ptr = extend_heap(MAX(asize * count, opts.chunk_size))) == NULL)) {
+            /* With the break used up, the rest are mapped one at a time */
+            while ((got < n) && ((out[got] = heap_exhausted(size, ALIGNMENT)) != NULL))
+                got++;
+            break;
+        }
+
+        count = place_batch(ptr, asize, count, out + got);
+        STAT_CLASS(asize, allocs, count);
+        got += count;
+    }
+    CHECK_HEAP(NULL);
+    return got;
+}
+
+/*
+ * free_block - Marks an allocated block free and coalesces it into the
+ * segregated lists.
+ */
+static void free_block(void *ptr) {
+    size_t size = GET_SIZE(HDRP(ptr));
+
+    REMOVE_REALLOC(HDRP(NEXT_BLKP(ptr)));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+    
+    PUT(HDRP(ptr), PACK(size, GET_PREV_ALLOC(HDRP(ptr))));
+    PUT(FTRP(ptr), PACK(size, 0));
+    
+    heap_release(coalesce(ptr), HDRP(ptr), HDRP(ptr) + size);
+}
+
+/*
+ * heap_release - Gives the memory of the free block ptr back to the system
+ * once the block is large. A block at the top of the arena's heap shrinks
+ * the break down to TRIMKEEP bytes. Otherwise only the pages newly freed
+ * between lo and hi are discarded, the rest having been discarded when it
+ * was freed; the block's links and footer are kept.
+ */
+static void heap_release(void *ptr, char *lo, char *hi) {
+    size_t size = GET_SIZE(HDRP(ptr));
+    size_t trim = size - TRIMKEEP;
+
+    if ((size >= TRIMTHRESHOLD) && (NEXT_BLKP(ptr) == arena->heap_end) &&
+        (mem_sbrk_from(arena->heap_end, -(int)trim) != (void *)-1)) {
+        delete_node(ptr);
+        arena->heap_end -= trim;
+        PUT(HDRP(ptr), PACK(TRIMKEEP, GET_PREV_ALLOC(HDRP(ptr))));
+        PUT(FTRP(ptr), PACK(TRIMKEEP, 0));
+        PUT_NO_REALLOC(HDRP(NEXT_BLKP(ptr)), PACK(0, 1));  /* New epilogue header */
+        insert_node(ptr, TRIMKEEP);
+        return;
+    }
+    if (size < DISCARDTHRESHOLD)
+        return;
+
+    lo = MAX(lo, (char *)ptr + (WSIZE << 2));
+    hi = MIN(hi, FTRP(ptr));
+    if (lo < hi)
+        mem_discard(lo, hi - lo);
+}
+
+/*
+ * mm_free - Frees a memory block. A block of another thread's arena is
+ * pushed onto that arena's remote-free stack instead, and a mapped block
+ * is unmapped.
+ */
+void mm_free(void *ptr) {
+    arena_t *owner;
+
+    if (ptr == NULL)
+        return;
+    if (IS_MAPPED(ptr)) {
+        mem_unmap(MAP_BASE(ptr));
+        return;
+    }
+
+    owner = ARENA_OF(ptr);
+    if ((owner != arena) || (arena_gen != heap_gen)) {
+        arena_free_remote(owner, ptr);
+        return;
+    }
+    local_free(ptr);
+    CHECK_HEAP(NULL);
+}
+
+/*
+ * mm_free_sized - Frees a block whose size, as last requested of mm_malloc,
+ * mm_realloc or mm_memalign, the caller knows. The size only decides
+ * whether the block may be a slab object: one above SLABMAX cannot be,
+ * so its slab page lookup is skipped. It cannot pick the free list, as
+ * the block may be larger than was asked for, so that still comes from
+ * the header. Mapped blocks are told by address, as a small request can
+ * be mapped too (a widely aligned one, or one made once the heap is full).
+ */
+void mm_free_sized(void *ptr, size_t size) {
+    arena_t *owner;
+
+    if (ptr == NULL)
+        return;
+    if (IS_MAPPED(ptr)) {
+        mem_unmap(MAP_BASE(ptr));
+        return;
+    }
+    if (size <= SLABMAX) {
+        mm_free(ptr);
+        return;
+    }
+
+    owner = &arenas[GET_ARENA(HDRP(ptr))];
+    if ((owner != arena) || (arena_gen != heap_gen)) {
+        arena_free_remote(owner, ptr);
+        return;
+    }
+    heap_free(ptr);
+    CHECK_HEAP(NULL);
+}
+
+/*
+ * mm_calloc - Allocates zeroed memory for an array of nmemb elements of
+ * size bytes each. Mappings and the bytes a heap extension has just added
+ * are zero already, so only the rest of the block is cleared.
+ */
+void *mm_calloc(size_t nmemb, size_t size) {
+    size_t total;
+    char *ptr, *lo, *hi;
+
+    if ((nmemb != 0) && (size > (size_t)-1 / nmemb))
+        return NULL;
+    total = nmemb * size;
+    if (total >= MMAPTHRESHOLD)
+        return map_alloc(total, ALIGNMENT);
+    if (!ARENA_READY())
+        return NULL;
+
+    /* Only an extension during this mm_malloc leaves a fresh range behind */
+    arena->fresh_lo = arena->fresh_hi = NULL;
+    if ((ptr = mm_malloc(total)) == NULL)
+        return NULL;
+
+    if (IS_MAPPED(ptr))
+        return ptr;
+    lo = MAX(arena->fresh_lo, ptr);
+    hi = MIN(arena->fresh_hi, ptr + total);
+    if (IS_SLAB(ptr) || (lo >= hi)) {
+        memset(ptr, 0, total);
+    } else {
+        memset(ptr, 0, lo - ptr);
+        memset(hi, 0, ptr + total - hi);
+    }
+    return ptr;
+}
+
+/*
+ * mm_usable_size - Returns the number of payload bytes of an allocated
+ * block, which may be more than were asked for.
+ */
+size_t mm_usable_size(void *ptr) {
+    if (ptr == NULL)
+        return 0;
+    if (IS_MAPPED(ptr))
+        return MAP_LEN(ptr) - MAPHDRSIZE - MAP_PAD(ptr);
+    if (IS_SLAB(ptr))
+        return RUN_OBJSIZE(RUN_OF(ptr));
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * local_free - Frees a block of this thread's arena.
+ */
+static void local_free(void *ptr) {
+    if (IS_SLAB(ptr))
+        slab_free(ptr);
+    else
+        heap_free(ptr);
+}
+
+/*
+ * heap_free - Frees a main-heap block of this thread's arena. Small blocks
+ * are cached in a quick list and only coalesced when that list overflows.
+ */
+static void heap_free(void *ptr) {
+    int q;
+    size_t size = GET_SIZE(HDRP(ptr));
+
+    STAT_CLASS(size, frees, 1);
+    if ((size <= SLABBLOCKMAX) && (arena->slab_live > 0))
+        arena->slab_live--;
+
+    if ((QUICKLISTMAX > 0) && (size <= QUICKMAX)) {
+        /* A cached block reserves nothing for its neighbours */
+        REMOVE_REALLOC(HDRP(NEXT_BLKP(ptr)));
+        REMOVE_REALLOC(HDRP(ptr));
+
+        q = QUICK_INDEX(size);
+        SET_SUCC(ptr, arena->quick_lists[q]);
+        arena->quick_lists[q] = ptr;
+        arena->quick_total++;
+        TOUCH_QUICK(q);
+        if (++arena->quick_counts[q] > QUICKLISTMAX)
+            quick_flush(q);
+        return;
+    }
+
+    free_block(ptr);
+}
+
+/*
+ * grow_backward - Grows an allocated block that its free next block (if
+ * any) cannot hold into the free block before it, and moves the payload
+ * down. Each such move copies the whole payload, so a block with a
+ * reserve, one that keeps growing, takes the reserve and at least its own
+ * size again on top of what it needs, and moves geometrically less often.
+ * The previous block keeps what is left if that is a whole free block.
+ * Returns NULL if the previous block is allocated, reserved or too small.
+ */
+static void *grow_backward(void *ptr, size_t asize, size_t reserve) {
+    size_t old_size = GET_SIZE(HDRP(ptr));
+    void *next = NEXT_BLKP(ptr);
+    size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    size_t prev_size, need, keep;
+    unsigned int prev_alloc;
+    char *prev, *bp;
+
+    if (GET_PREV_ALLOC(HDRP(ptr)))
+        return NULL;
+    prev = PREV_BLKP(ptr);
+    prev_size = GET_SIZE(HDRP(prev));
+    need = asize - old_size - next_size;
+    if ((prev_size < need) || GET_REALLOC(HDRP(prev)))
+        return NULL;
+
+    delete_node(prev);
+    if (next_size != 0)
+        delete_node(next);
+
+    prev_alloc = GET_PREV_ALLOC(HDRP(prev));
+    need = MIN(need + (reserve ? ALIGN(MAX(reserve, old_size)) : 0), prev_size);
+    keep = prev_size - need;
+    if (keep >= MINBLOCKSIZE) {
+        STAT_CLASS(prev_size, splits, 1);
+        PUT(HDRP(prev), PACK(keep, prev_alloc));
+        PUT(FTRP(prev), PACK(keep, 0));
+        insert_node(prev, keep);
+        bp = prev + keep;
+        prev_alloc = 0;
+    } else {
+        bp = prev;
+        need = prev_size;
+    }
+
+    /* The old payload only moves down, past the new header */
+    memmove(bp, ptr, old_size - WSIZE);
+    PUT_NO_REALLOC(HDRP(bp), PACK(need + old_size + next_size, prev_alloc | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    return bp;
+}
+
+/*
+ * move_pages - Moves a large block to a new block of asize bytes that
+ * starts at the same offset into a page, so mem_move remaps the whole
+ * pages of the payload instead of copying them. Only a free block with
+ * room for that alignment is used; returns NULL if there is none, and
+ * the caller copies instead.
+ */
+static void *move_pages(void *ptr, size_t asize) {
+    size_t pagesize = mem_pagesize();
+    size_t span = asize + pagesize + (MINBLOCKSIZE << 1);
+    char *fit, *bp, *end;
+
+    if ((fit = find_fit(span)) == NULL)
+        return NULL;
+
+    /* Back-place, like place: last congruent address leaving no gap or a whole free block */
+    end = fit + GET_SIZE(HDRP(fit));
+    bp = end - asize;
+    bp -= (bp - (char *)ptr) & (pagesize - 1);
+    if ((bp + asize != end) && (end - (bp + asize) < MINBLOCKSIZE))
+        bp -= pagesize;
+    place_aligned(fit, bp, asize);
+
+    mem_move(bp, ptr, GET_SIZE(HDRP(ptr)) - WSIZE);
+    local_free(ptr);
+    return bp;
+}
+
+/*
+ * realloc_finish - Tags the block after a reallocated block if the block
+ * has less than its reserve to spare, and records the block's history
+ * under its new address.
+ */
+static void *realloc_finish(void *ptr, void *new_ptr, size_t new_size,
+                            unsigned int count, size_t step) {
+    realloc_hist_t *hist = REALLOC_HIST(new_ptr);
+    size_t size = GET_SIZE(HDRP(new_ptr));
+
+    if (size < new_size + REALLOC_RESERVE(count, step, new_size))
+        SET_REALLOC(HDRP(NEXT_BLKP(new_ptr)));
+
+    if ((new_ptr != ptr) && (REALLOC_HIST(ptr)->block == PTR_TO_LINK(ptr)))
+        REALLOC_HIST(ptr)->block = 0;
+    if (arena->last_alloc == ptr)
+        arena->last_alloc = new_ptr;
+    hist->block = PTR_TO_LINK(new_ptr);
+    hist->size = size;
+    hist->step = step;
+    hist->count = count;
+    return new_ptr;
+}
+
+/*
+ * ptr_compare - Orders two pointers by address, for qsort.
+ */
+static int ptr_compare(const void *a, const void *b) {
+    char *p = *(char * const *)a;
+    char *q = *(char * const *)b;
+
+    return (p > q) - (p < q);
+}
+
+/*
+ * mm_free_batch - Frees n blocks, sorting ptrs by address in place. Each
+ * run of physically adjacent blocks of this thread's arena is freed as one
+ * block, bypassing the quick lists.
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    size_t i, j, size;
+    char *bp;
+
+    /* Batches carved by mm_malloc_batch usually come back in order */
+    for (i = 1; (i < n) && ((char *)ptrs[i - 1] <= (char *)ptrs[i]); i++)
+        ;
+    if (i < n)
+        qsort(ptrs, n, sizeof(void *), ptr_compare);
+
+    for (i = 0; i < n; i = j) {
+        bp = ptrs[i];
+        if ((bp == NULL) || IS_MAPPED(bp) || (ARENA_OF(bp) != arena) ||
+            (arena_gen != heap_gen) || IS_SLAB(bp)) {
+            mm_free(bp);
+            j = i + 1;
+            continue;
+        }
+
+        /* Blocks of one segment all belong to its arena */
+        size = 0;
+        for (j = i; (j < n) && (ptrs[j] == bp + size); j++) {
+            STAT_CLASS(GET_SIZE(HDRP(ptrs[j])), frees, 1);
+            if ((GET_SIZE(HDRP(ptrs[j])) <= SLABBLOCKMAX) && (arena->slab_live > 0))
+                arena->slab_live--;
+            size += GET_SIZE(HDRP(ptrs[j]));
+        }
+
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        free_block(bp);
+    }
+    CHECK_HEAP(NULL);
+}
+
+/*
+ * mm_realloc - Reallocates a memory block with advanced heuristics.
+ */
+void *mm_realloc(void *ptr, size_t size) {
+    void *new_ptr = realloc_block(ptr, size);
+
+    CHECK_HEAP(new_ptr);
     return new_ptr;
 }
+
+/*
+ * realloc_block - Reallocates a memory block for mm_realloc.
+ */
+static void *realloc_block(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    if (IS_MAPPED(ptr))
+        return map_realloc(ptr, size);
+
+    /*
+     * Another arena's block cannot grow in place here, and a huge request
+     * gets a mapping of its own, so both always move
+     */
+    if ((size >= MMAPTHRESHOLD) || (ARENA_OF(ptr) != arena) || (arena_gen != heap_gen)) {
+        size_t old_usable = mm_usable_size(ptr);
+        void *new_ptr;
+
+        if ((new_ptr = mm_malloc(size)) == NULL)
+            return NULL;
+        memcpy(new_ptr, ptr, MIN(old_usable, size));
+        mm_free(ptr);
+        return new_ptr;
+    }
+
+    /* Slab objects stay put while they fit, otherwise move to the main heap */
+    if (IS_SLAB(ptr)) {
+        size_t objsize = RUN_OBJSIZE(RUN_OF(ptr));
+        void *new_ptr;
+
+        if (size <= objsize)
+            return ptr;
+        if ((new_ptr = mm_malloc(size)) == NULL)
+            return NULL;
+        memcpy(new_ptr, ptr, objsize);
+        slab_free(ptr);
+        return new_ptr;
+    }
+
+    void *new_ptr = ptr;
+    size_t new_size = MAX(ALIGN(size + WSIZE), MINBLOCKSIZE);
+    size_t old_size = GET_SIZE(HDRP(ptr));
+    realloc_hist_t *hist = REALLOC_HIST(ptr);
+    unsigned int count = 1;
+    size_t step = (new_size > old_size) ? new_size - old_size : 0;
+    int remainder;
+
+    /* A matching entry is this block's, unless it was freed and reused at the same size */
+    if ((hist->block == PTR_TO_LINK(ptr)) && (hist->size == old_size)) {
+        count = MIN(hist->count + 1, REALLOCGROWMAX + 2);
+        step = MAX(step, hist->step);
+    }
+    size_t reserve = REALLOC_RESERVE(count, step, new_size);
+
+    /* Shrinking never moves the block */
+    if (new_size < old_size)
+        return realloc_finish(ptr, ptr, new_size, count, step);
+    
+    int block_buffer = GET_SIZE(HDRP(ptr)) - new_size;
+
+    /* Allocate more space if needed */
+    if (block_buffer < 0) {
+        void *next = NEXT_BLKP(ptr);
+        int next_free = !GET_ALLOC(HDRP(next)) || !GET_SIZE(HDRP(next));
+        int at_end = !GET_SIZE(HDRP(next)) || !GET_SIZE(HDRP(NEXT_BLKP(next)));
+
+        remainder = old_size + GET_SIZE(HDRP(next)) - new_size;
+
+        int grow = next_free && (remainder >= 0);
+
+        /* Growing backwards costs no heap, so it comes before extending */
+        if (!grow && ((new_ptr = grow_backward(ptr, new_size, reserve)) != NULL))
+            return realloc_finish(ptr, new_ptr, new_size, count, step);
+        new_ptr = ptr;
+
+        /*
+         * Grow in place if the next block is free and big enough, or if it
+         * is free (or the epilogue) and the heap can be extended behind it.
+         * The extension only lands behind it if no other arena moved the
+         * break first.
+         */
+        if (next_free && (remainder < 0) && at_end) {
+            size_t extendsize = ALIGN(MAX(-remainder + reserve, opts.chunk_size));
+            void *ext;
+
+            /* With the break used up, the block moves to a mapping below */
+            if (((ext = extend_heap(extendsize)) != NULL) && (ext == next)) {
+                remainder += extendsize;
+                grow = 1;
+            }
+        }
+
+        if (grow) {
+            delete_node(NEXT_BLKP(ptr));
+            PUT_NO_REALLOC(HDRP(ptr), PACK(new_size + remainder, GET_PREV_ALLOC(HDRP(ptr)) | 1));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+
+        } else if ((old_size >= PAGEMOVEMIN) && ((new_ptr = move_pages(ptr, new_size + reserve)) != NULL)) {
+            /* Moved by remapping pages */
+        } else { /* Fallback to malloc and free */
+            if ((new_ptr = mm_malloc(new_size + reserve - WSIZE)) == NULL)
+                return NULL;
+            memcpy(new_ptr, ptr, old_size - WSIZE);
+            mm_free(ptr);
+            /* A mapped block or slab object has no neighbour to tag */
+            if (IS_MAPPED(new_ptr) || IS_SLAB(new_ptr))
+                return new_ptr;
+        }
+    }
+
+    return realloc_finish(ptr, new_ptr, new_size, count, step);
+}
+
+/* --- Heap Checker --- */
+
+/* More list nodes than the heap can hold blocks means a cycle */
+#define CHECK_NODEMAX (mem_heapsize() / MINBLOCKSIZE)
+
+/*
+ * check_error - Reports an inconsistency found at bp and counts it.
+ */
+static int check_error(const void *bp, const char *msg) {
+    fprintf(stderr, "mm_check: %p: %s\n", bp, msg);
+    return 1;
+}
+
+/*
+ * check_block - Checks a main-heap block of this arena against its
+ * neighbours: size, owner, the next block's prev_alloc bit, a free block's
+ * footer and coalescing, and that a tagged block follows an allocated one.
+ */
+static int check_block(void *bp) {
+    char *hdr = HDRP(bp);
+    size_t size = GET_SIZE(hdr);
+    char *next = NEXT_BLKP(bp);
+    int errors = 0;
+
+    if (((char *)bp < heap_base) || ((char *)bp > (char *)mem_heap_hi()))
+        return check_error(bp, "block outside the heap");
+    if ((size < MINBLOCKSIZE) || (next > (char *)mem_heap_hi() + 1))
+        return check_error(bp, "bad block size");
+    if ((unsigned long)bp % ALIGNMENT)
+        errors += check_error(bp, "misaligned payload");
+    if ((GET(hdr) & ~SIZE_MASK & ~0x7U) != arena->tag)
+        errors += check_error(bp, "block of another arena");
+    if (!GET_PREV_ALLOC(HDRP(next)) != !GET_ALLOC(hdr))
+        errors += check_error(bp, "next block's prev_alloc bit disagrees");
+    if (GET_REALLOC(hdr) && !GET_PREV_ALLOC(hdr))
+        errors += check_error(bp, "tagged block after a free block");
+
+    if (GET_ALLOC(hdr)) {
+        if (IS_SLAB(bp) && ((size != RUNSIZE) || ((char *)bp - heap_base) % RUNSIZE))
+            errors += check_error(bp, "slab run of the wrong size or alignment");
+        return errors;
+    }
+    if ((GET_SIZE(FTRP(bp)) != size) || GET_ALLOC(FTRP(bp)))
+        errors += check_error(bp, "footer disagrees with header");
+    if (!GET_PREV_ALLOC(hdr) || !GET_ALLOC(HDRP(next)))
+        errors += check_error(bp, "free block not coalesced");
+    if (IS_SLAB(bp))
+        errors += check_error(bp, "free block marked as a slab run");
+    return errors;
+}
+
+/*
+ * check_tree - Checks the subtree at node: every node a free block of at
+ * least TREECUTOFF, in (size, address) order, with consistent parent links
+ * and no red node with a red child. Returns the subtree's black height, or
+ * -1 on an error, and counts its nodes into count.
+ */
+static int check_tree(void *node, void *parent, int *errors, size_t *count) {
+    int left, right;
+
+    if (node == NULL)
+        return 1;
+    (*count)++;
+    *errors += check_block(node);
+    if (GET_ALLOC(HDRP(node)) || (GET_SIZE(HDRP(node)) < TREECUTOFF))
+        *errors += check_error(node, "tree node not a large free block");
+    if (PARENT(node) != parent)
+        *errors += check_error(node, "tree parent link broken");
+    if ((LEFT(node) != NULL) && !TREE_LESS(LEFT(node), node))
+        *errors += check_error(node, "tree out of order on the left");
+    if ((RIGHT(node) != NULL) && !TREE_LESS(node, RIGHT(node)))
+        *errors += check_error(node, "tree out of order on the right");
+    if (IS_RED(node) && (IS_RED(LEFT(node)) || IS_RED(RIGHT(node))))
+        *errors += check_error(node, "red tree node with a red child");
+
+    left = check_tree(LEFT(node), node, errors, count);
+    right = check_tree(RIGHT(node), node, errors, count);
+    if ((left < 0) || (right < 0))
+        return -1;
+    if (left != right) {
+        *errors += check_error(node, "tree black heights differ");
+        return -1;
+    }
+    return left + !IS_RED(node);
+}
+
+/*
+ * check_lists - Checks the segregated lists in mask: every node a free
+ * block of the list's class, in ascending size order, with consistent
+ * links, and the occupancy bitmap in step. Counts the nodes into count.
+ */
+static int check_lists(unsigned long long mask, size_t *count) {
+    int errors = 0;
+    int list;
+    void *ptr, *prev;
+    size_t size, last;
+
+    for (; mask; mask &= mask - 1) {
+        list = __builtin_ctzll(mask);
+        if (!(arena->seglist_bitmap & LIST_BIT(list)) != (arena->segregated_free_lists[list] == NULL))
+            errors += check_error(arena->segregated_free_lists[list], "list bitmap disagrees");
+
+        if (list == TREE_LIST) {
+            if (IS_RED(TREE_ROOT))
+                errors += check_error(TREE_ROOT, "red tree root");
+            check_tree(TREE_ROOT, NULL, &errors, count);
+            continue;
+        }
+
+        prev = NULL;
+        last = 0;
+        for (ptr = arena->segregated_free_lists[list]; ptr != NULL; ptr = SUCC(ptr)) {
+            if (((*count)++ > CHECK_NODEMAX) || ((errors += check_block(ptr)) > 0))
+                return errors + 1;
+            size = GET_SIZE(HDRP(ptr));
+            if (GET_ALLOC(HDRP(ptr)))
+                errors += check_error(ptr, "allocated block in a free list");
+            if (get_list_index(size) != list)
+                errors += check_error(ptr, "block in the wrong size class");
+            if ((lists_by_addr & LIST_BIT(list)) ? ((char *)ptr < (char *)prev) : (size < last))
+                errors += check_error(ptr, "free list out of order");
+            if (PRED(ptr) != prev)
+                errors += check_error(ptr, "free list pred link broken");
+            last = size;
+            prev = ptr;
+        }
+    }
+    return errors;
+}
+
+/*
+ * check_quick - Checks the quick lists in mask: every node an allocated
+ * block of the list's size, and each list's count.
+ */
+static int check_quick(unsigned long long mask) {
+    int errors = 0;
+    int q, n;
+    void *ptr;
+
+    for (; mask; mask &= mask - 1) {
+        q = __builtin_ctzll(mask);
+        n = 0;
+        for (ptr = arena->quick_lists[q]; ptr != NULL; ptr = SUCC(ptr)) {
+            if ((n > CHECK_NODEMAX) || ((errors += check_block(ptr)) > 0))
+                return errors + 1;
+            if (!GET_ALLOC(HDRP(ptr)) || (QUICK_INDEX(GET_SIZE(HDRP(ptr))) != q))
+                errors += check_error(ptr, "block of the wrong size in a quick list");
+            n++;
+        }
+        if (n != arena->quick_counts[q])
+            errors += check_error(arena->quick_lists[q], "quick list count disagrees");
+    }
+    return errors;
+}
+
+/*
+ * check_run - Checks a slab run's header: a marked run of a slab class
+ * whose free count matches its bitmap.
+ */
+static int check_run(void *run) {
+    unsigned long long *map = RUN_MAP(run);
+    unsigned int objsize = RUN_OBJSIZE(run);
+    unsigned int nfree = 0;
+    int i;
+
+    if (!IS_SLAB(run))
+        return check_error(run, "slab run not marked in the page bitmap");
+    if ((objsize == 0) || (objsize > SLABMAX) || (objsize % ALIGNMENT))
+        return check_error(run, "slab run of no slab class");
+    for (i = 0; i < RUNMAPWORDS; i++)
+        nfree += __builtin_popcountll(map[i]);
+    if ((nfree != RUN_NFREE(run)) || (nfree > RUN_NOBJ(objsize)))
+        return check_error(run, "slab run free count disagrees with its bitmap");
+    return 0;
+}
+
+/*
+ * check_heap - Checks the whole arena: walks every block of every segment,
+ * then every free, quick and slab list, and matches the free blocks found
+ * against the nodes of the lists.
+ */
+static int check_heap(void) {
+    int errors = 0;
+    int class;
+    size_t walked = 0, listed = 0;
+    int last_found = (arena->last_alloc == NULL);
+    char *seg, *bp;
+    void *run;
+
+    for (seg = arena->segments; seg != NULL; seg = LINK_TO_PTR(GET(seg - DSIZE))) {
+        if ((GET(HDRP(seg)) != PACK(DSIZE, 1)) || (GET(seg) != PACK(DSIZE, 1)))
+            errors += check_error(seg, "bad prologue");
+        if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(seg))))
+            errors += check_error(seg, "block after the prologue not marked prev_alloc");
+
+        for (bp = NEXT_BLKP(seg); GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp)) {
+            if (check_block(bp) > 0)
+                return errors + 1;
+            if (!GET_ALLOC(HDRP(bp)))
+                walked++;
+            else if (IS_SLAB(bp))
+                errors += check_run(bp);
+            else if (bp == arena->last_alloc)
+                last_found = 1;
+        }
+        if (!GET_ALLOC(HDRP(bp)))
+            errors += check_error(bp, "bad epilogue");
+        if ((seg == arena->segments) && (bp != arena->heap_end))
+            errors += check_error(bp, "epilogue is not at the end of the heap");
+    }
+    if (!last_found)
+        errors += check_error(arena->last_alloc, "last allocation is not an allocated block");
+
+    errors += check_lists(LIST_BIT(SEGLISTNUM - 1) | (LIST_BIT(SEGLISTNUM - 1) - 1), &listed);
+    if (listed != walked)
+        errors += check_error(NULL, "free lists and heap disagree on the free blocks");
+
+    errors += check_quick((1ULL << QUICKLISTNUM) - 1);
+    listed = 0;
+    for (class = 0; class < QUICKLISTNUM; class++)
+        listed += arena->quick_counts[class];
+    if (listed != (size_t)arena->quick_total)
+        errors += check_error(NULL, "quick list total disagrees");
+
+    for (class = 0; class < SLABCLASSNUM; class++) {
+        for (run = arena->slab_runs[class]; run != NULL; run = RUN_NEXT(run)) {
+            if ((errors += check_run(run)) > 0)
+                return errors;
+            if ((RUN_OBJSIZE(run) != SLAB_OBJSIZE(class)) || (RUN_NFREE(run) == 0))
+                errors += check_error(run, "full or foreign run in a slab list");
+        }
+    }
+    return errors;
+}
+
+#ifdef DEBUG
+/*
+ * check_touched - Checks only what an operation can have changed: the
+ * block it returned and its neighbours, and the lists it touched.
+ */
+static int check_touched(void *bp) {
+    int errors = 0;
+    size_t listed = 0;
+
+    if ((bp != NULL) && !IS_MAPPED(bp)) {
+        if (IS_SLAB(bp)) {
+            errors += check_run(RUN_OF(bp));
+        } else if ((errors += check_block(bp)) == 0) {
+            if (!GET_PREV_ALLOC(HDRP(bp)))
+                errors += check_block(PREV_BLKP(bp));
+            if (!GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+                errors += check_block(NEXT_BLKP(bp));
+        }
+    }
+    errors += check_lists(arena->dirty_lists, &listed);
+    errors += check_quick(arena->dirty_quick);
+    return errors;
+}
+
+/*
+ * check_op - Runs the check the current mode asks for after an operation
+ * that returned bp (or NULL), and aborts if the heap is inconsistent.
+ */
+static void check_op(void *bp) {
+    int errors;
+
+    if ((arena == NULL) || (arena_gen != heap_gen))
+        return;
+
+    if (check_mode == MM_CHECK_INCREMENTAL) {
+        errors = check_touched(bp);
+    } else if ((check_mode == MM_CHECK_FULL) || (++arena->check_ops >= check_period)) {
+        arena->check_ops = 0;
+        errors = check_heap();
+    } else {
+        return;
+    }
+    arena->dirty_lists = 0;
+    arena->dirty_quick = 0;
+
+    if (errors > 0) {
+        fprintf(stderr, "mm_check: %d inconsistencies, aborting\n", errors);
+        abort();
+    }
+}
+#endif
+
+/*
+ * mm_check - Checks every block and list of the calling thread's arena.
+ * Returns nonzero iff the heap is consistent; each problem found is
+ * reported on stderr.
+ */
+int mm_check(void) {
+    if (!ARENA_READY())
+        return 0;
+    arena->dirty_lists = 0;
+    arena->dirty_quick = 0;
+    return check_heap() == 0;
+}
+
+/*
+ * mm_check_mode - Selects the check run after every mm_malloc, mm_free
+ * and mm_realloc: none, full, full every period operations of an arena,
+ * or incremental. Takes effect only in a DEBUG build.
+ */
+void mm_check_mode(int mode, int period) {
+    check_period = MAX(period, 1);
+    check_mode = mode;
+}
+
+/* --- Statistics --- */
+
+#ifdef MM_STATS
+/*
+ * stat_free_block - Adds a free block to the snapshot in stats.
+ */
+static void stat_free_block(mm_stats_t *stats, void *ptr) {
+    size_t size = GET_SIZE(HDRP(ptr));
+    int bin = (int)(sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size));
+
+    stats->free_hist[MIN(bin, MM_STATS_HISTBINS - 1)]++;
+    stats->free_blocks++;
+    stats->free_bytes += size;
+    stats->largest_free = MAX(stats->largest_free, size);
+}
+
+/*
+ * stat_tree - Adds every block of the subtree at node to the snapshot.
+ */
+static void stat_tree(mm_stats_t *stats, void *node) {
+    if (node == NULL)
+        return;
+    stat_free_block(stats, node);
+    stat_tree(stats, LEFT(node));
+    stat_tree(stats, RIGHT(node));
+}
+#endif
+
+/*
+ * mm_stats - Copies the calling thread's arena counters into stats and
+ * adds a snapshot of its free blocks. Returns 0, or -1 if the allocator
+ * was built without MM_STATS or the thread has no arena.
+ */
+int mm_stats(mm_stats_t *stats) {
+#ifdef MM_STATS
+    size_t size;
+    void *ptr;
+    int list, q;
+
+    if (!ARENA_READY())
+        return -1;
+
+    *stats = arena->stats;
+    for (size = TREECUTOFF; size >= MINBLOCKSIZE; size -= ALIGNMENT)
+        stats->classes[get_list_index(size)].min_size = size;
+
+    for (list = 0; list < TREE_LIST; list++)
+        for (ptr = arena->segregated_free_lists[list]; ptr != NULL; ptr = SUCC(ptr))
+            stat_free_block(stats, ptr);
+    stat_tree(stats, TREE_ROOT);
+
+    for (q = 0; q < QUICKLISTNUM; q++) {
+        for (ptr = arena->quick_lists[q]; ptr != NULL; ptr = SUCC(ptr)) {
+            stats->quick_blocks++;
+            stats->quick_bytes += GET_SIZE(HDRP(ptr));
+        }
+    }
+    return 0;
+#else
+    memset(stats, 0, sizeof(mm_stats_t));
+    return -1;
+#endif
+}
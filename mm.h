@@ -1,9 +1,102 @@
 #include <stdio.h>
 
 extern int mm_init (void);
+
+/*
+ * Placement policies, thresholds and growth sizes, fixed for a heap by
+ * mm_init_opts.
+ * MM_FIT_BEST keeps the free lists sorted by size, so the first fit is the
+ * best one. MM_FIT_FIRST and MM_FIT_NEXT keep them in address order and
+ * take the lowest-addressed fit, or the next fit after where the last
+ * search stopped. MM_FIT_GOOD is best fit that gives up on a list after
+ * fit_candidates nodes and moves on to a larger class. Blocks of 4KB and
+ * up stay in a best-fit tree under every policy. addr_order_small and
+ * prefer_adjacent trade a little speed for locality between blocks
+ * allocated together. mm_init uses MM_OPTS_DEFAULT.
+ */
+#define MM_FIT_BEST  0
+#define MM_FIT_FIRST 1
+#define MM_FIT_NEXT  2
+#define MM_FIT_GOOD  3
+
+typedef struct {
+    int fit;                      /* MM_FIT_* placement policy */
+    unsigned int fit_candidates;  /* Nodes MM_FIT_GOOD visits per list */
+    size_t back_place_min;        /* Smallest block placed at the end of its free block */
+    size_t split_min;             /* Smallest remainder split off a free block */
+    size_t chunk_size;            /* Smallest heap extension */
+    size_t init_chunk_size;       /* Size of the heap mm_init starts with */
+    size_t realloc_buffer;        /* Smallest reserve of a block that keeps being reallocated */
+    int addr_order_small;         /* Keep the exact-size lists in address order */
+    int prefer_adjacent;          /* Allocate next to the last block when a neighbour fits */
+} mm_opts_t;
+
+#define MM_OPTS_DEFAULT { MM_FIT_BEST, 4, 100, 24, 1 << 12, 1 << 6, 1 << 7, 0, 0 }
+
+extern int mm_init_opts(const mm_opts_t *opts);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * Heap consistency checking. mm_check checks the calling thread's arena
+ * and returns nonzero iff it is consistent. In a DEBUG build mm_check_mode
+ * also checks after every mm_malloc, mm_free and mm_realloc, aborting on
+ * the first inconsistency: the whole arena (FULL), the whole arena every
+ * period operations (SAMPLED), or only the lists and blocks the operation
+ * touched (INCREMENTAL).
+ */
+#define MM_CHECK_OFF         0
+#define MM_CHECK_FULL        1
+#define MM_CHECK_SAMPLED     2
+#define MM_CHECK_INCREMENTAL 3
+
+extern int mm_check(void);
+extern void mm_check_mode(int mode, int period);
+
+/*
+ * Allocation statistics of the calling thread's arena since mm_init,
+ * collected only in a build with -DMM_STATS ("make STATS=1"); otherwise
+ * mm_stats returns -1. Classes are the segregated free lists, the last
+ * one holding every block of 4KB and up. The free-block fields are a
+ * snapshot taken by the call.
+ */
+#define MM_STATS_CLASSES  64
+#define MM_STATS_HISTBINS 32
+
+typedef struct {
+    size_t min_size;                 /* Smallest block size of the class */
+    unsigned long allocs;            /* Blocks of the class allocated */
+    unsigned long frees;             /* Blocks of the class freed */
+    unsigned long splits;            /* Free blocks of the class split by a placement */
+    unsigned long coalesces;         /* Merges that produced a block of the class */
+} mm_class_stats_t;
+
+typedef struct {
+    mm_class_stats_t classes[MM_STATS_CLASSES];
+    unsigned long extends;           /* extend_heap calls */
+    unsigned long fit_searches;      /* Free-list searches for a fit */
+    unsigned long fit_walked;        /* Nodes they visited in all */
+    unsigned long fit_walked_max;    /* Most nodes one of them visited */
+    unsigned long insert_searches;   /* Free-list insertions */
+    unsigned long insert_walked;     /* Nodes they visited in all */
+    unsigned long insert_walked_max; /* Most nodes one of them visited */
+    unsigned long tag_skips;         /* Fitting free blocks skipped for their realloc tag */
+    unsigned long free_hist[MM_STATS_HISTBINS];  /* Free blocks by floor(log2(size)) */
+    unsigned long free_blocks;       /* Free blocks in the free lists */
+    size_t free_bytes;               /* Their total size */
+    size_t largest_free;             /* Size of the largest one */
+    unsigned long quick_blocks;      /* Blocks cached in the quick lists */
+    size_t quick_bytes;              /* Their total size */
+} mm_stats_t;
+
+extern int mm_stats(mm_stats_t *stats);
 
 
 /* 
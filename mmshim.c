@@ -0,0 +1,244 @@
+/*
+ * mmshim.c - Makes the mm package the malloc of any dynamically linked
+ *            program, through LD_PRELOAD:
+ *
+ *     unix> make libmm.so
+ *     unix> LD_PRELOAD=./libmm.so ls -l
+ *
+ * libmm.so exports the C and POSIX allocation functions on top of mm_*,
+ * with memlib.c built with MEM_SYSTEM so that the heap comes from mmap
+ * rather than from libc, and no libc malloc is left to call. The
+ * allocator is initialized by the first allocation of the process.
+ * Blocks allocated before libmm.so was in place are never freed, and
+ * realloc copies them into mm.
+ *
+ * The aligned entry points are mm_memalign, whose blocks mm_free and
+ * mm_realloc take like any other. As in glibc, a request for more than
+ * PTRDIFF_MAX bytes fails with ENOMEM before it reaches mm. With MMTRACE
+ * set, every request is also recorded as a trace (see recorder.c).
+ */
+#define _GNU_SOURCE            /* for RTLD_NEXT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "recorder.h"
+
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static int shim_ready = 0;     /* set once mm_init has run */
+
+/* Initialize the allocator on the first call */
+#define SHIM_INIT() do { if (!shim_ready) pthread_once(&shim_once, shim_init); } while (0)
+
+/* Like glibc, refuse any object larger than a pointer difference can span */
+#define SHIM_TOO_BIG(size) ((size) > PTRDIFF_MAX)
+
+/*
+ * shim_init - Sets up the heap and the mm package. A fork holds memlib's
+ *     lock, so the child's heap is never left locked by another thread.
+ */
+static void shim_init(void)
+{
+    mem_init();
+    if (mm_init() < 0) {
+	fprintf(stderr, "libmm: mm_init failed\n");
+	abort();
+    }
+    pthread_atfork(mem_fork_prepare, mem_fork_parent, mem_fork_child);
+    shim_ready = 1;
+}
+
+/*
+ * shim_owns - Returns whether block came from mm. Blocks the dynamic
+ *     linker allocated before libmm.so was in place did not.
+ */
+static int shim_owns(void *block)
+{
+    if (!shim_ready)
+	return 0;
+    if (((char *)block >= (char *)mem_heap_lo()) && ((char *)block <= (char *)mem_heap_hi()))
+	return 1;
+    return mem_is_mapped(block, block);
+}
+
+/*
+ * shim_adopt - Reallocates a block mm did not hand out, such as one the
+ *     dynamic linker allocated before libmm.so was in place, by copying
+ *     it into a new mm block. Its size is what the next malloc_usable_size
+ *     in the search order, libc's, reports. The old block is left alone,
+ *     as free leaves it.
+ */
+static void *shim_adopt(void *ptr, size_t size)
+{
+    static size_t (*usable)(void *) = NULL;
+    size_t old_size;
+    void *new_ptr;
+
+    if ((usable == NULL) &&
+	((usable = (size_t (*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size")) == NULL)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    old_size = usable(ptr);
+    if ((new_ptr = malloc(size)) != NULL)
+	memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+    return new_ptr;
+}
+
+/*
+ * shim_memalign - Returns size bytes aligned to alignment, a power of 2
+ */
+static void *shim_memalign(size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (SHIM_TOO_BIG(size)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    SHIM_INIT();
+    if ((ptr = mm_memalign(alignment, size ? size : 1)) == NULL)
+	errno = ENOMEM;
+    else if (rec_on)
+	rec_alloc(ptr, size ? size : 1);
+    return ptr;
+}
+
+/*********************************************
+ * The standard allocation functions of libc
+ *********************************************/
+
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    if (SHIM_TOO_BIG(size)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    SHIM_INIT();
+    if ((ptr = mm_malloc(size ? size : 1)) == NULL)
+	errno = ENOMEM;
+    else if (rec_on)
+	rec_alloc(ptr, size ? size : 1);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if ((ptr != NULL) && shim_owns(ptr)) {
+	/* Recorded first, as the address may be handed out again at once */
+	if (rec_on)
+	    rec_free(ptr);
+	mm_free(ptr);
+    }
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if ((nmemb != 0) && (size > PTRDIFF_MAX / nmemb)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    SHIM_INIT();
+    if ((nmemb == 0) || (size == 0))
+	nmemb = size = 1;
+    if ((ptr = mm_calloc(nmemb, size)) == NULL)
+	errno = ENOMEM;
+    else if (rec_on)
+	rec_alloc(ptr, nmemb * size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+
+    if (SHIM_TOO_BIG(size)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!shim_owns(ptr))
+	return shim_adopt(ptr, size);
+    if (rec_on)
+	rec_realloc_from(ptr);
+    if ((new_ptr = mm_realloc(ptr, size)) == NULL)
+	errno = ENOMEM;
+    if (rec_on)
+	rec_realloc_to(new_ptr, size);
+    return new_ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if ((alignment % sizeof(void *)) || (alignment & (alignment - 1)))
+	return EINVAL;
+    if ((ptr = shim_memalign(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if ((alignment == 0) || (alignment & (alignment - 1))) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return shim_memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    size_t a = sizeof(void *);
+
+    /* Like glibc, round a bad alignment up to a power of 2 */
+    while ((a < alignment) && (a != 0))
+	a <<= 1;
+    if (a == 0) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return shim_memalign(a, size);
+}
+
+void *valloc(size_t size)
+{
+    return shim_memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = getpagesize();
+
+    if (size > (size_t)-1 - pagesize) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return shim_memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    if ((ptr == NULL) || !shim_owns(ptr))
+	return 0;
+    return mm_usable_size(ptr);
+}
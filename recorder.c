@@ -0,0 +1,588 @@
+/*
+ * recorder.c - Records every allocation request a program makes of
+ *              libmm.so as a trace that mdriver can replay:
+ *
+ *     unix> MMTRACE=app.rep LD_PRELOAD=./libmm.so app
+ *     unix> ./mdriver -f app.rep
+ *
+ * With MMTRACE_BINARY set as well, the trace is written in the binary
+ * format of trace.h. A "%p" in the file name is replaced by the process
+ * id. Without one, a program started while another process records to
+ * the same file does not record at all.
+ *
+ * A requesting thread only appends to a ring of its own, a single-
+ * producer, single-consumer buffer that a background writer thread
+ * drains. Every request takes a number from a global counter, a free
+ * before the block is released and an allocation after it is obtained,
+ * so the writer can merge the rings into an order in which no address
+ * is live twice. A realloc takes a number for each half. Ids are given
+ * out by the writer alone, from a table of the live addresses, so the
+ * requesting side never looks anything up.
+ *
+ * The header is rewritten after every batch, so the file is a valid
+ * trace whenever the program stops. Blocks allocated before recording
+ * began are not in the trace, and neither are their frees. A child
+ * process stops recording at fork.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "recorder.h"
+#include "trace.h"
+
+#define REC_SLOTS    (1 << 16)  /* requests a thread's ring holds (a power of 2) */
+#define REC_MAXRINGS 1024       /* threads recording at once */
+#define REC_WINDOW   (1 << 18)  /* entries the writer puts back in order at once (a power of 2) */
+#define REC_MAXIDS   (1 << 30)  /* ids a traceop_t can hold */
+#define REC_BUFSIZE  (1 << 16)  /* bytes of output buffered between writes */
+#define REC_IDLE_NS  1000000    /* writer's sleep while every ring is empty (1ms) */
+#define REC_HDRSIZE  44         /* four "%-10d\n" lines of a .rep header */
+#define MAXLINE      1024       /* max string size */
+
+/* Kinds of ring entries */
+enum {REC_ALLOC, REC_FREE, REC_FROM, REC_TO};
+
+/* A request, as a requesting thread logs it */
+typedef struct {
+    unsigned long seq;          /* position in the order of all requests */
+    void *ptr;                  /* block allocated, freed or reallocated */
+    unsigned int size;          /* bytes requested, for REC_ALLOC and REC_TO */
+    unsigned short type;        /* REC_xxx */
+    unsigned short ring;        /* index of the ring it was logged in */
+} rec_entry_t;
+
+/* A thread's ring, with its two ends on cache lines of their own */
+typedef struct {
+    unsigned long head;         /* next slot the owner fills ... */
+    char pad1[64 - sizeof(unsigned long)];
+    unsigned long tail;         /* ... and the next one the writer reads */
+    char pad2[64 - sizeof(unsigned long)];
+    int dead;                   /* set when the owner exits, for another thread to take */
+    int index;                  /* position in rings */
+    rec_entry_t slots[REC_SLOTS];
+} rec_ring_t;
+
+/* A live block of the trace */
+typedef struct {
+    void *ptr;                  /* its address, NULL if the slot is empty */
+    unsigned int id;
+    unsigned int size;
+} rec_block_t;
+
+int rec_on = 0;
+
+/* Shared with the requesting threads */
+static int started = 0;                 /* set while the writer runs */
+static int stopping = 0;                /* set to make the writer finish */
+static unsigned long rec_seq = 0;       /* number of the next request */
+static rec_ring_t *rings[REC_MAXRINGS];
+static int nrings = 0;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread rec_ring_t *my_ring = NULL;
+static __thread int muted = 0;          /* set in the writer, whose requests are not recorded */
+
+/* The writer's own */
+static pthread_t writer;
+static int fd = -1;
+static int binary = 0;
+static int writing = 1;                 /* cleared when the trace stops early */
+static int broken = 0;                  /* set if the file cannot be written */
+static rec_entry_t *window = NULL;      /* entries drained, each at its seq modulo REC_WINDOW */
+static unsigned long next_seq = 0;      /* seq of the next entry to write */
+static rec_block_t *blocks = NULL;      /* live blocks, open-addressed with linear probing */
+static size_t block_slots = 0, block_used = 0;
+static rec_block_t limbo[REC_MAXRINGS]; /* block each ring's realloc is in the middle of */
+static char buf[REC_BUFSIZE];
+static size_t buflen = 0;
+static int num_ids = 0, num_ops = 0;
+static size_t live = 0, peak = 0;       /* payload bytes live, and the most ever */
+
+#define BLOCK_HASH(p) ((((unsigned long)(p) >> 3) * 0x9e3779b97f4a7c15UL) >> 20)
+
+/*******************************************
+ * The requesting side
+ *******************************************/
+
+/*
+ * rec_release - Lets another thread take over the ring of an exiting one
+ */
+static void rec_release(void *r)
+{
+    my_ring = NULL;
+    __atomic_store_n(&((rec_ring_t *)r)->dead, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * rec_attach - Gives the calling thread a ring, reusing one whose owner
+ *     has exited, or returns NULL and stops recording if there is none
+ */
+static rec_ring_t *rec_attach(void)
+{
+    rec_ring_t *r = NULL;
+    int i;
+
+    pthread_mutex_lock(&rings_lock);
+    for (i = 0; (i < nrings) && (r == NULL); i++)
+	if (__atomic_load_n(&rings[i]->dead, __ATOMIC_ACQUIRE)) {
+	    r = rings[i];
+	    r->dead = 0;
+	}
+    if ((r == NULL) && (nrings < REC_MAXRINGS)) {
+	r = mmap(NULL, sizeof(rec_ring_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) {
+	    r = NULL;
+	} else {
+	    r->index = nrings;
+	    rings[nrings] = r;
+	    __atomic_store_n(&nrings, nrings + 1, __ATOMIC_RELEASE);
+	}
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    if (r == NULL) {
+	rec_on = 0;
+	fprintf(stderr, "libmm: too many threads to record, the trace stops here\n");
+	return NULL;
+    }
+    /* Set first, as pthread_setspecific may allocate */
+    my_ring = r;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+/*
+ * rec_push - Logs a request in the calling thread's ring, waiting for
+ *     the writer if the ring is full
+ */
+static void rec_push(int type, void *ptr, size_t size)
+{
+    rec_ring_t *r = my_ring;
+    rec_entry_t *e;
+    unsigned long head;
+
+    if (muted)
+	return;
+    if ((r == NULL) && ((r = rec_attach()) == NULL))
+	return;
+
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == REC_SLOTS)
+	sched_yield();
+    e = &r->slots[head & (REC_SLOTS - 1)];
+    e->seq = __atomic_fetch_add(&rec_seq, 1, __ATOMIC_SEQ_CST);
+    e->ptr = ptr;
+    e->size = (size > INT_MAX) ? INT_MAX : size;
+    e->type = type;
+    e->ring = r->index;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void rec_alloc(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+	rec_push(REC_ALLOC, ptr, size);
+}
+
+void rec_free(void *ptr)
+{
+    rec_push(REC_FREE, ptr, 0);
+}
+
+void rec_realloc_from(void *ptr)
+{
+    rec_push(REC_FROM, ptr, 0);
+}
+
+void rec_realloc_to(void *ptr, size_t size)
+{
+    rec_push(REC_TO, ptr, size);
+}
+
+/*******************************************
+ * The writer
+ *******************************************/
+
+/*
+ * rec_stop_recording - Stops the trace where it is, with a reason
+ */
+static void rec_stop_recording(char *why)
+{
+    if (writing) {
+	rec_on = 0;
+	writing = 0;
+	fprintf(stderr, "libmm: %s, the trace stops here\n", why);
+    }
+}
+
+/*
+ * rec_header - Writes the header, for the ops written so far, at the
+ *     start of the file
+ */
+static void rec_header(void)
+{
+    char hdr[REC_HDRSIZE + 1];
+    bintrace_t bin;
+    int sugg_heapsize = (peak > INT_MAX) ? INT_MAX : (int)peak;
+
+    if (binary) {
+	memcpy(bin.magic, BINTRACE_MAGIC, sizeof(bin.magic));
+	bin.sugg_heapsize = sugg_heapsize;
+	bin.num_ids = num_ids;
+	bin.num_ops = num_ops;
+	bin.weight = 1;
+	pwrite(fd, &bin, sizeof(bin), 0);
+    } else {
+	sprintf(hdr, "%-10d\n%-10d\n%-10d\n%-10d\n", sugg_heapsize, num_ids, num_ops, 1);
+	pwrite(fd, hdr, REC_HDRSIZE, 0);
+    }
+}
+
+/*
+ * rec_flush - Writes out the buffered ops and updates the header
+ */
+static void rec_flush(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (!broken && (done < buflen)) {
+	if ((n = write(fd, buf + done, buflen - done)) <= 0) {
+	    rec_stop_recording("cannot write the trace");
+	    broken = 1;
+	    break;
+	}
+	done += n;
+    }
+    buflen = 0;
+    if (!broken)
+	rec_header();
+}
+
+/*
+ * rec_uint - Appends a space and a number to the buffer, which is a good
+ *     deal faster than sprintf
+ */
+static void rec_uint(unsigned int n)
+{
+    char digits[16];
+    int i = 0;
+
+    do {
+	digits[i++] = '0' + n % 10;
+	n /= 10;
+    } while (n != 0);
+    buf[buflen++] = ' ';
+    while (i > 0)
+	buf[buflen++] = digits[--i];
+}
+
+/*
+ * rec_op - Appends a request to the trace
+ */
+static void rec_op(int type, unsigned int id, unsigned int size)
+{
+    traceop_t op;
+
+    if (buflen + MAXLINE > REC_BUFSIZE)
+	rec_flush();
+    if (binary) {
+	op.type = type;
+	op.index = id;
+	op.size = size;
+	memcpy(buf + buflen, &op, sizeof(op));
+	buflen += sizeof(op);
+    } else {
+	buf[buflen++] = (type == ALLOC) ? 'a' : (type == REALLOC) ? 'r' : 'f';
+	rec_uint(id);
+	if (type != FREE)
+	    rec_uint(size);
+	buf[buflen++] = '\n';
+    }
+    num_ops++;
+}
+
+/*
+ * block_find - Returns the slot of ptr in the live blocks, or of the
+ *     empty slot ending its probe sequence
+ */
+static rec_block_t *block_find(void *ptr)
+{
+    size_t i = BLOCK_HASH(ptr) & (block_slots - 1);
+
+    while ((blocks[i].ptr != NULL) && (blocks[i].ptr != ptr))
+	i = (i + 1) & (block_slots - 1);
+    return &blocks[i];
+}
+
+/*
+ * block_add - Records a live block, growing the table if it is half full
+ */
+static void block_add(void *ptr, unsigned int id, unsigned int size)
+{
+    rec_block_t *old = blocks, *slot;
+    size_t old_slots = block_slots, i;
+
+    if (2 * (block_used + 1) > block_slots) {
+	block_slots = block_slots ? 2 * block_slots : (1 << 16);
+	blocks = mmap(NULL, block_slots * sizeof(rec_block_t), PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (blocks == MAP_FAILED) {
+	    fprintf(stderr, "libmm: out of memory for the trace\n");
+	    abort();
+	}
+	for (i = 0; i < old_slots; i++)
+	    if (old[i].ptr != NULL)
+		*block_find(old[i].ptr) = old[i];
+	if (old != NULL)
+	    munmap(old, old_slots * sizeof(rec_block_t));
+    }
+    slot = block_find(ptr);
+    slot->ptr = ptr;
+    slot->id = id;
+    slot->size = size;
+    block_used++;
+}
+
+/*
+ * block_take - Removes ptr from the live blocks into *b. The entries
+ *     after it in its probe sequence are moved back to keep every
+ *     sequence unbroken. Returns 0 if ptr is not live.
+ */
+static int block_take(void *ptr, rec_block_t *b)
+{
+    rec_block_t *slot = (block_slots != 0) ? block_find(ptr) : NULL;
+    size_t hole, home, i;
+
+    if ((slot == NULL) || (slot->ptr == NULL))
+	return 0;
+    *b = *slot;
+    hole = slot - blocks;
+    slot->ptr = NULL;
+    for (i = (hole + 1) & (block_slots - 1); blocks[i].ptr != NULL;
+	 i = (i + 1) & (block_slots - 1)) {
+	home = BLOCK_HASH(blocks[i].ptr) & (block_slots - 1);
+	/* Move it into the hole unless its home lies between the two */
+	if (((i - home) & (block_slots - 1)) >= ((i - hole) & (block_slots - 1))) {
+	    blocks[hole] = blocks[i];
+	    blocks[i].ptr = NULL;
+	    hole = i;
+	}
+    }
+    block_used--;
+    return 1;
+}
+
+/*
+ * rec_new_block - Gives a newly allocated block the next id
+ */
+static void rec_new_block(void *ptr, unsigned int size)
+{
+    if ((num_ids == REC_MAXIDS) || (num_ops == INT_MAX)) {
+	rec_stop_recording("the trace is full");
+	return;
+    }
+    rec_op(ALLOC, num_ids, size);
+    block_add(ptr, num_ids++, size);
+    live += size;
+    peak = (live > peak) ? live : peak;
+}
+
+/*
+ * rec_entry - Turns an entry, in seq order, into a trace request
+ */
+static void rec_entry(rec_entry_t *e)
+{
+    rec_block_t b;
+
+    switch (e->type) {
+    case REC_ALLOC:
+	rec_new_block(e->ptr, e->size);
+	break;
+    case REC_FREE:
+	if (block_take(e->ptr, &b)) {
+	    rec_op(FREE, b.id, 0);
+	    live -= b.size;
+	}
+	break;
+    case REC_FROM:
+	/* The address may be handed out again before the realloc returns */
+	if (!block_take(e->ptr, &limbo[e->ring]))
+	    limbo[e->ring].ptr = NULL;
+	break;
+    case REC_TO:
+	b = limbo[e->ring];
+	limbo[e->ring].ptr = NULL;
+	if (b.ptr == NULL) {
+	    if (e->ptr != NULL)
+		rec_new_block(e->ptr, e->size);
+	} else if (e->ptr == NULL) {
+	    /* A failed realloc leaves the block where it was */
+	    block_add(b.ptr, b.id, b.size);
+	} else if (num_ops < INT_MAX) {
+	    rec_op(REALLOC, b.id, e->size);
+	    block_add(e->ptr, b.id, e->size);
+	    live = live + e->size - b.size;
+	    peak = (live > peak) ? live : peak;
+	}
+	break;
+    }
+}
+
+/*
+ * rec_drain - Moves entries from the rings into their slots of the
+ *     window, leaving in a ring those too far ahead of next_seq to fit.
+ *     Returns the number moved.
+ */
+static size_t rec_drain(void)
+{
+    int i, n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+    unsigned long head, tail;
+    size_t got = 0;
+    rec_entry_t *e;
+
+    for (i = 0; i < n; i++) {
+	head = __atomic_load_n(&rings[i]->head, __ATOMIC_ACQUIRE);
+	for (tail = rings[i]->tail; tail != head; tail++) {
+	    e = &rings[i]->slots[tail & (REC_SLOTS - 1)];
+	    if (e->seq - next_seq >= REC_WINDOW)
+		break;
+	    window[e->seq & (REC_WINDOW - 1)] = *e;
+	    got++;
+	}
+	__atomic_store_n(&rings[i]->tail, tail, __ATOMIC_RELEASE);
+    }
+    return got;
+}
+
+/*
+ * rec_write_ready - Writes out the entries of the window that follow on
+ *     from those already written
+ */
+static void rec_write_ready(void)
+{
+    rec_entry_t *e;
+
+    while ((e = &window[next_seq & (REC_WINDOW - 1)])->seq == next_seq) {
+	if (writing)
+	    rec_entry(e);
+	next_seq++;
+    }
+    if (buflen > 0)
+	rec_flush();
+}
+
+/*
+ * rec_writer - Body of the writer thread. Every request before the one
+ *     the writer waits for is in some ring, as its number is taken just
+ *     before it is logged, so the window never fills for good.
+ */
+static void *rec_writer(void *arg)
+{
+    struct timespec idle = {0, REC_IDLE_NS};
+    int stop;
+
+    muted = 1;
+    for (;;) {
+	stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+	if (rec_drain() > 0)
+	    rec_write_ready();
+	else if (stop)
+	    break;
+	else
+	    nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * rec_child - Stops recording in the child of a fork, which has no writer
+ */
+static void rec_child(void)
+{
+    rec_on = 0;
+    started = 0;
+}
+
+/*
+ * rec_start - Starts recording if MMTRACE names a trace file
+ */
+static void rec_start(void) __attribute__((constructor));
+static void rec_start(void)
+{
+    char *name = getenv("MMTRACE");
+    char path[MAXLINE], *p;
+    size_t len = 0;
+
+    if ((name == NULL) || (*name == '\0'))
+	return;
+    binary = (getenv("MMTRACE_BINARY") != NULL);
+
+    /* Expand %p */
+    for (p = name; (*p != '\0') && (len < MAXLINE - 32); p++) {
+	if ((p[0] == '%') && (p[1] == 'p')) {
+	    len += sprintf(path + len, "%d", (int)getpid());
+	    p++;
+	} else {
+	    path[len++] = *p;
+	}
+    }
+    path[len] = '\0';
+
+    /* The lock keeps the programs this one starts off its trace */
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+	fprintf(stderr, "libmm: cannot create trace %s\n", path);
+	return;
+    }
+    if ((flock(fd, LOCK_EX | LOCK_NB) < 0) || (ftruncate(fd, 0) < 0) ||
+	(lseek(fd, binary ? sizeof(bintrace_t) : REC_HDRSIZE, SEEK_SET) < 0)) {
+	close(fd);
+	return;
+    }
+    rec_header();
+
+    /* Slot 0 would otherwise pass for the entry of seq 0 */
+    window = mmap(NULL, REC_WINDOW * sizeof(rec_entry_t), PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (window == MAP_FAILED) {
+	close(fd);
+	return;
+    }
+    window[0].seq = ~0UL;
+
+    pthread_key_create(&ring_key, rec_release);
+    pthread_atfork(NULL, NULL, rec_child);
+    if (pthread_create(&writer, NULL, rec_writer, NULL) != 0) {
+	fprintf(stderr, "libmm: cannot start the trace writer\n");
+	close(fd);
+	return;
+    }
+    started = 1;
+    rec_on = 1;
+}
+
+/*
+ * rec_finish - Writes out what is left of the trace when the program exits
+ */
+static void rec_finish(void) __attribute__((destructor));
+static void rec_finish(void)
+{
+    if (!started)
+	return;
+    rec_on = 0;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    started = 0;
+    close(fd);
+}
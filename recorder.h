@@ -0,0 +1,14 @@
+/*
+ * recorder.h - Records the allocation requests of a program running on
+ *     libmm.so as a malloc lab trace
+ */
+
+/* Set while requests are being recorded */
+extern int rec_on;
+
+void rec_alloc(void *ptr, size_t size);
+void rec_free(void *ptr);
+
+/* A realloc is recorded in two halves, before and after mm_realloc */
+void rec_realloc_from(void *ptr);
+void rec_realloc_to(void *ptr, size_t size);
@@ -0,0 +1,31 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - the trace request record, and the binary trace format
+ *     that mdriver maps and gentrace writes
+ */
+
+/* Characterizes a single trace operation (allocator request) */
+enum {ALLOC, FREE, REALLOC};          /* types of request */
+typedef struct {
+    unsigned int type : 2;            /* type of request */
+    unsigned int index : 30;          /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/*
+ * Header of a binary trace file, which is followed directly by num_ops
+ * 8-byte traceop_t records in host byte order, so the file can be
+ * mapped and used as the ops array as it is
+ */
+#define BINTRACE_MAGIC "MMTRACE1"
+typedef struct {
+    char magic[8];       /* BINTRACE_MAGIC, without the trailing NUL */
+    int sugg_heapsize;   /* the four header fields of the .rep file */
+    int num_ids;
+    int num_ops;
+    int weight;
+} bintrace_t;
+
+#endif /* __TRACE_H_ */